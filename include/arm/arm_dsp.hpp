@@ -0,0 +1,207 @@
+#pragma once
+#include "armulator.hpp"
+#include "values.hpp"
+#include "helper.hpp"
+
+namespace arm {
+
+	//ARMv5TE DSP extension (VersionSpec::E) and CLZ (v5)
+	//QADD/QSUB/QDADD/QDSUB, SMULxy/SMLAxy/SMULWy/SMLAWy/SMLALxy, LDRD/STRD and CLZ.
+	//PLD is in the NV space, which stepArm skips; as a hint that is all it has to do.
+	//Saturation and overflow use the host's overflow checks and selects, so there are no data dependent branches.
+	//Q (PSR::qMask) is sticky; instructions only set it, writing the cpsr clears it.
+
+	//Signed add that sets q on overflow (wraps)
+	_inline_ u32 addQ(u32 a, u32 b, u32 &q) {
+
+		#if defined(__GNUC__) || defined(__clang__)
+			i32 s;
+			q |= u32(__builtin_add_overflow(i32(a), i32(b), &s));
+			return u32(s);
+		#else
+			const u32 s = a + b;
+			q |= ((a ^ s) & (b ^ s)) >> 31;
+			return s;
+		#endif
+	}
+
+	//Signed saturating add and subtract; set q if the result saturated
+	//The saturated value has the sign of a, since overflow needs a to have the other sign than the result
+
+	_inline_ u32 qadd(u32 a, u32 b, u32 &q) {
+
+		u32 o;
+
+		#if defined(__GNUC__) || defined(__clang__)
+			i32 s;
+			o = u32(__builtin_add_overflow(i32(a), i32(b), &s));
+		#else
+			const u32 s = a + b;
+			o = ((a ^ s) & (b ^ s)) >> 31;
+		#endif
+
+		q |= o;
+		return o ? u32(i32(a) >> 31) ^ 0x7FFFFFFF : u32(s);
+	}
+
+	_inline_ u32 qsub(u32 a, u32 b, u32 &q) {
+
+		u32 o;
+
+		#if defined(__GNUC__) || defined(__clang__)
+			i32 s;
+			o = u32(__builtin_sub_overflow(i32(a), i32(b), &s));
+		#else
+			const u32 s = a - b;
+			o = ((a ^ b) & (a ^ s)) >> 31;
+		#endif
+
+		q |= o;
+		return o ? u32(i32(a) >> 31) ^ 0x7FFFFFFF : u32(s);
+	}
+
+	//Signed halfword of a register; top selects bits 16-31
+	_inline_ i32 half(u32 v, u32 top) {
+		return i32(v << (top ? 0 : 16)) >> 16;
+	}
+
+	enum DspStep : u8 {
+		NOT_DSP,			//Not one of the above for the version; decoded elsewhere
+		EXECUTED,
+		UNDEFINED			//Encoded like one of the above, but undefined (LDRD/STRD with an odd register)
+	};
+
+	//Runs the instruction in ir if it's one of the above for the version; the caller raises UND if it's undefined
+	//LDR takes 1S + 1N + 1I and LDRD another N; STRD takes 2N, SMLALxy 2 cycles and the others 1
+
+	template<Armulator::Version v, typename Cycles, typename Memory>
+	_inline_ DspStep stepDsp(Registers &r, Memory &mem, const u8 *m, Cycles &cycles) {
+
+		if constexpr ((v & 0xFF) < Armulator::VersionSpec::v5)
+			return NOT_DSP;
+
+		//CLZ Rd, Rm
+
+		else if ((r.ir & 0x0FFF0FF0) == 0x016F0F10) {
+			_Rd4_12 = clz(_Rm4_0);
+			return EXECUTED;
+		}
+
+		else if constexpr (!(v & Armulator::VersionSpec::E))
+			return NOT_DSP;
+
+		//Q{D}ADD/Q{D}SUB Rd, Rm, Rn; bit 21 subtracts, bit 22 doubles Rn first (saturated)
+
+		else if ((r.ir & 0x0F900FF0) == 0x01000050) {
+
+			u32 q{};
+			u32 n = _Rn4_16;
+
+			if (r.ir & 0x400000)
+				n = qadd(n, n, q);
+
+			_Rd4_12 = r.ir & 0x200000 ? qsub(_Rm4_0, n, q) : qadd(_Rm4_0, n, q);
+			r.cpsr.value |= q * PSR::qMask;
+			return EXECUTED;
+		}
+
+		//Halfword multiplies; Rd (or RdHi) is at bit 16 and Rn (or RdLo) at bit 12
+		//x (bit 5) picks the half of Rm, y (bit 6) the half of Rs
+
+		else if ((r.ir & 0x0F900090) == 0x01000080) {
+
+			const i32 a = half(_Rm4_0, r.ir & 0x20), b = half(_Rs4_8, r.ir & 0x40);
+			u32 q{};
+
+			switch ((r.ir >> 21) & 3) {
+
+				//SMLAxy Rd, Rm, Rs, Rn; Q on overflow of the accumulate
+
+				case 0:
+					_Rn4_16 = addQ(u32(a * b), _Rd4_12, q);
+					break;
+
+				//SMLAWy Rd, Rm, Rs, Rn / SMULWy Rd, Rm, Rs (x set); top 32 bits of the 48-bit product
+
+				case 1: {
+
+					const u32 p = u32((i64(i32(_Rm4_0)) * b) >> 16);
+
+					if (r.ir & 0x20)
+						_Rn4_16 = p;
+					else
+						_Rn4_16 = addQ(p, _Rd4_12, q);
+
+					break;
+				}
+
+				//SMLALxy RdLo, RdHi, Rm, Rs; 64-bit accumulate, no Q
+
+				case 2: {
+
+					++cycles;
+
+					const u64 acc = ((u64(_Rn4_16) << 32) | _Rd4_12) + u64(i64(a * b));
+					_Rd4_12 = u32(acc);
+					_Rn4_16 = u32(acc >> 32);
+					break;
+				}
+
+				//SMULxy Rd, Rm, Rs
+
+				default:
+					_Rn4_16 = u32(a * b);
+			}
+
+			r.cpsr.value |= q * PSR::qMask;
+			return EXECUTED;
+		}
+
+		//LDRD/STRD Rd, [Rn, #/Rm]; addressing mode 3, loads or stores Rd and Rd + 1
+		//P (bit 24) pre-indexes, U (bit 23) adds the offset, I (bit 22) has an 8-bit immediate, W (bit 21) writes back
+		//Post-indexing always writes back
+
+		else if ((r.ir & 0x0E1000D0) == 0x000000D0) {
+
+			const u32 d = Rd4_12;
+
+			if (d & 1)
+				return UNDEFINED;
+
+			const u32 offset = r.ir & 0x400000 ? ((r.ir >> 4) & 0xF0) | (r.ir & 0xF) : _Rm4_0;
+
+			u32 &base = _Rn4_16;
+			const u32 target = r.ir & 0x800000 ? base + offset : base - offset;
+			const u32 address = r.ir & 0x1000000 ? target : base;
+			const bool writeBack = !(r.ir & 0x1000000) || (r.ir & 0x200000);
+
+			if (r.ir & 0x20) {
+
+				cycles += 2;
+
+				mem.template set<u32>(address, r.registers[m[d]]);
+				mem.template set<u32>(address + 4, r.registers[m[d + 1]]);
+
+				if (writeBack)
+					base = target;
+
+			} else {
+
+				cycles += 3;
+
+				const u32 lo = mem.template get<u32>(address), hi = mem.template get<u32>(address + 4);
+
+				if (writeBack)
+					base = target;
+
+				r.registers[m[d]] = lo;
+				r.registers[m[d + 1]] = hi;
+			}
+
+			return EXECUTED;
+		}
+
+		else return NOT_DSP;
+	}
+
+}
\ No newline at end of file
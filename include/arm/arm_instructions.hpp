@@ -2,6 +2,7 @@
 #include "armulator.hpp"
 #include "values.hpp"
 #include "helper.hpp"
+#include "arm_dsp.hpp"
 
 namespace arm {
 
@@ -23,12 +24,60 @@ namespace arm {
 		}
 	}*/
 
-	template<Armulator::Version v>
-	_inline_ void stepArm(Registers &r, arm::Armulator::Memory &, const u8 *&, usz &) {
+	//Returns true if the pipeline was refilled (branch or exception); this ends a block
+	//Coprocessor instructions go to cp; without it (or the coprocessor) they're undefined
+	template<Armulator::Version v, typename Cycles = usz, typename Memory = arm::Armulator::Memory>
+	_inline_ bool stepArm(Registers &r, Memory &mem, const u8 *&m, Cycles &cycles, Coprocessors *cp = nullptr) {
 
 		//Conditional 
-		if (!arm::doCondition(arm::cond::Condition(Cond4_28), r.cpsr))
-			return;
+		if (!arm::doCondition(arm::cond::Condition(Cond4_28), r.cpsr)) {
+			arm::fetchNext<false>(r, mem);
+			return false;
+		}
+
+		//DSP extension and CLZ (see arm_dsp.hpp)
+
+		switch (stepDsp<v>(r, mem, m, cycles)) {
+
+			case EXECUTED:
+				arm::fetchNext<false>(r, mem);
+				return false;
+
+			case UNDEFINED:
+				arm::exception<false, arm::Exception::UND>(r, mem, cycles, m);
+				return true;
+
+			default:
+				break;
+		}
+
+		//VFP (see vfp.hpp)
+
+		if constexpr ((v & Armulator::VersionSpec::VFP) != 0)
+			if (Vfp::owns(r.ir)) {
+
+				if (cp && cp->vfp.step(r, mem, m, cycles)) {
+					arm::fetchNext<false>(r, mem);
+					return false;
+				}
+
+				arm::exception<false, arm::Exception::UND>(r, mem, cycles, m);
+				return true;
+			}
+
+		//MCR/MRC p15 (see cp15.hpp); a change of the protection unit's enable applies from the next block
+
+		if constexpr ((v & Armulator::VersionSpec::P) != 0)
+			if ((r.ir & 0x0F000F10) == 0x0E000F10) {
+
+				if (cp && cp->cp15.transfer(r, m)) {
+					arm::fetchNext<false>(r, mem);
+					return false;
+				}
+
+				arm::exception<false, arm::Exception::UND>(r, mem, cycles, m);
+				return true;
+			}
 
 	//	switch (Op4_24) {
 
@@ -67,6 +116,10 @@ namespace arm {
 	//undef:
 	//	arm::exception<false, arm::Exception::UND>(r, mem, c, m);
 
+		//Not decoded (yet); undefined, so the block ends and the guest's handler (or the run limit) takes over
+
+		arm::exception<false, arm::Exception::UND>(r, mem, cycles, m);
+		return true;
 	}
 
 }
\ No newline at end of file
@@ -1,10 +1,19 @@
 #pragma once
 #include "registers.hpp"
+#include "scheduler.hpp"
+#include "idle.hpp"
+#include "host_hooks.hpp"
+#include "instrumentation.hpp"
+#include "thumb/fusion.hpp"
+#include "coprocessors.hpp"
 #include "emu/memory.hpp"
 #include "emu/stack.hpp"
+#include <atomic>
 
 namespace arm {
 
+	struct SwiTable;
+
 	//!ARM7 emulator
 	//The armulator **RUNS IN THIS PROCESS** giving it access to memory allocated here as well
 	//But only if it's allocated at 0xF0000000 -> 0xFFFFFFFF
@@ -24,6 +33,9 @@ namespace arm {
 				D = 1 << 9,			//Debugger
 				M = 1 << 10,		//Multiplier
 				I = 1 << 11,		//Debug operations through ICE
+				E = 1 << 12,		//DSP extension (v5TE); saturating arithmetic, halfword multiplies, LDRD/STRD
+				VFP = 1 << 13,		//VFPv2 floating point coprocessor (CP10/CP11)
+				P = 1 << 14,		//Protection unit and TCM (CP15)
 
 				TDMI = T | D | M | I
 
@@ -34,6 +46,9 @@ namespace arm {
 		enum Version {
 			ARM7TDMI = VersionSpec::v4 | VersionSpec::TDMI,
 			ARM9TDMI = VersionSpec::v5 | VersionSpec::TDMI,
+			ARM9E = VersionSpec::v5 | VersionSpec::TDMI | VersionSpec::E,		//ARM966E-S (or ARM946E-S without its protection unit)
+			ARM9EVFP = ARM9E | VersionSpec::VFP,								//ARM926EJ-S with VFP9-S
+			ARM946ES = ARM9E | VersionSpec::P,									//ARM946E-S with its protection unit
 		};
 
 		enum DebugType {
@@ -42,6 +57,13 @@ namespace arm {
 			PRINT_REGISTERS = 2		//Output the registers to the console
 		};
 
+		//How cycles are counted; the cheaper models are meant for throughput (batch jobs, call)
+		enum class CycleModel : u8 {
+			EXACT,					//Instruction timings (memory accesses, multiplies, pipeline refills)
+			APPROXIMATE,			//1 cycle per instruction and 2 per pipeline refill
+			NONE					//Only the instruction count; events and run limits are in instructions
+		};
+
 		using Memory = emu::Memory32<0x80000000>;
 		using Stack = emu::Stack<Memory, u32>;
 
@@ -65,12 +87,118 @@ namespace arm {
 		static void print(Registers &r);			//Print all registers
 		static void printPSR(PSR psr);				//Print the PSR
 
+		//Run until the cycle counter reaches until (or stop is called)
+		//Execution only stops at block boundaries (taken branches and exceptions), so it can overshoot.
+		//The first run fills the pipeline from r.pc
+		//Hooks is an instrumentation policy (see instrumentation.hpp)
+		template<Version v, DebugType type = NONE, CycleModel model = CycleModel::EXACT, typename Hooks = NoHooks>
+		void run(usz until);
+
+		//Make the current run return at the next block boundary
+		__forceinline void stop() {
+			target = cycles;
+			stopped = true;
+		}
+
+		//Call a guest function like a C function; add 1 to the address for a thumb function
+		//Arguments go into r0-r3 and the rest onto the stack (AAPCS), below the current sp.
+		//lr is set to the sentinel, which stops the run when the function returns.
+		//Returns r0 (low) and r1 (high); sp (of the calling mode), the cpsr and the pc are restored,
+		//other registers are left as the function left them. A run after the call continues where the last one stopped.
+		//Hooks is the instrumentation policy and model the cycle model of the run (see run)
+		template<Version v, typename Hooks = NoHooks, CycleModel model = CycleModel::EXACT, typename ...Args>
+		u64 call(u32 address, Args ...args);
+
+		//Return address of call; has to be mapped memory that isn't a thumb function entry
+		//The reset vector is never entered in thumb mode, so it's a safe default
+		u32 sentinel{};
+
+		//Enter an exception from outside of the instruction stream (e.g. a scheduler callback raising an IRQ)
+		//Refills the pipeline at the exception vector; returns false if the exception is disabled (IRQ/FIQ)
+		//The run reports it to its instrumentation (Hooks::onException) once the callback returns
+		template<Exception e>
+		bool exception();
+
+		//Request an IRQ or FIQ; lock-free, so it can be called from any thread (e.g. a host device thread)
+		//The run loop checks the pending mask at block boundaries and delivers it once the cpsr allows it.
+		//FIQ goes before IRQ. A request stays pending until it is delivered or cleared.
+		template<Exception e>
+		__forceinline void raiseInterrupt() {
+			pending.fetch_or(interruptBit<e>(), std::memory_order_release);
+		}
+
+		template<Exception e>
+		__forceinline void clearInterrupt() {
+			pending.fetch_and(~interruptBit<e>(), std::memory_order_release);
+		}
+
+		//AAPCS arguments for host hooks; the first four words are in r0-r3, the rest on the stack
+		__forceinline u32 argument(usz i) {
+			return i < 4 ? r.loReg[i] : memory.get<u32>(r.reg(Register::sp) + u32(i - 4) * 4);
+		}
+
+		//AAPCS results; a word in r0, a double word in r0 (low) and r1 (high)
+		__forceinline void result(u32 v) { r.loReg[0] = v; }
+
+		__forceinline void result(u64 v) {
+			r.loReg[0] = u32(v);
+			r.loReg[1] = u32(v >> 32);
+		}
+
 		Registers r;
 		Memory memory;
+		Scheduler scheduler;
+		IdleDetector idle;			//Disabled by default; skips idle loops up to the next event
+		thumb::Fusion fusion;		//Thumb pairs run as one; none by default (see thumb/fusion.hpp)
+		Coprocessors cp;			//Only used by versions that have them (VersionSpec::VFP, VersionSpec::P)
+
+		HostHooks hooks;			//Host functions replacing guest functions
+
+		//BIOS services that are emulated natively (see bios.hpp); null runs the guest's BIOS
+		const SwiTable *swi{};
+
+		usz cycles{};			//Cycles executed since creation
 
 	private:
 
+		enum Interrupt : u32 {
+			IRQ = 1,
+			FIQ = 2
+		};
+
+		template<Exception e>
+		static constexpr u32 interruptBit() {
+			static_assert(e == Exception::IRQ || e == Exception::FIQ, "Only IRQ and FIQ can be raised asynchronously");
+			return e == Exception::FIQ ? FIQ : IRQ;
+		}
+
+		//Deliver the pending interrupts that are enabled
+		template<typename Hooks>
+		void interrupt();
+
+		//Pass the exceptions entered through exception() to Hooks::onException
+		template<typename Hooks>
+		void report();
+
+		//If interrupt would deliver one of the pending interrupts
+		__forceinline bool interruptible() const {
+			const u32 p = pending.load(std::memory_order_relaxed);
+			return ((p & FIQ) && !r.cpsr.disableFIQ()) || ((p & IRQ) && !r.cpsr.disableIRQ());
+		}
+
+		//Run the SWI natively if it has a handler; returns false if the guest's BIOS should handle it
+		bool hle(const u8 *&hirMap);
+
+		//Run the host function hooked at the current block and return to lr; false if it isn't hooked
+		bool hook(const u8 *&hirMap);
+
+		std::atomic<u32> pending{};
+
+		usz target{};
 		bool init = false;
+		bool stopped = false;
+
+		u8 raised{};			//Exceptions entered through exception() that aren't reported yet; a bit per vector
 
 	};
 
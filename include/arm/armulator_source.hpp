@@ -2,6 +2,7 @@
 #include "arm/armulator.hpp"
 #include "arm/thumb/tharmulator_source.hpp"
 #include "arm/arm_instructions.hpp"
+#include "arm/bios.hpp"
 
 namespace arm {
 
@@ -37,22 +38,218 @@ namespace arm {
 		);
 	}
 
-	template<bool isThumb, Armulator::Version v>
-	_inline_ void step(Registers &r, arm::Armulator::Memory &memory, const u8 *&hirMap, u64 &cycles) {
+	//The counter the instructions add their timings to; discarded unless cycles are exact
+
+	template<Armulator::CycleModel model>
+	_inline_ auto &timing(usz &cycles, NoCycles &none) {
+		if constexpr (model == Armulator::CycleModel::EXACT)
+			return cycles;
+		else
+			return none;
+	}
+
+	//fused is the mask of thumb pairs to run as one (see thumb/fusion.hpp)
+	//cp are the coprocessors of ARM instructions; null makes their instructions undefined
+	//instructions counts the instructions issued (2 for a pair); unused without instrumentation
+
+	template<bool isThumb, Armulator::Version v, Armulator::CycleModel model, typename Memory>
+	_inline_ bool step(Registers &r, Memory &memory, const u8 *&hirMap, usz &cycles, u32 fused, Coprocessors *cp, usz &instructions) {
 
 		//Perform code cached in ir/nir registers
 
-		if constexpr (isThumb)
-			stepThumb<v>(r, memory, hirMap, cycles);
-		else
-			stepArm<v>(r, memory, hirMap, cycles);
+		NoCycles none;
+		auto &t = timing<model>(cycles, none);
+
+		bool refilled;
+
+		if constexpr (isThumb) {
+
+			if (fused) {
+
+				const thumb::Pair pair = thumb::pairOf(r.ir, r.nir);
+
+				if (fused & thumb::Fusion::bit(pair)) {
+					refilled = thumb::stepPair<v>(r, memory, hirMap, t, pair);
+					cycles += 2;
+					instructions += 2;
+					return refilled;
+				}
+			}
+
+			refilled = thumb::stepThumb<v>(r, memory, hirMap, t);
+
+		} else
+			refilled = stepArm<v>(r, memory, hirMap, t, cp);
 
 		++cycles;
+		++instructions;
+		return refilled;
+	}
+
+	//What an aborting instruction can have changed: the pipeline, cpsr (POP pc) and the registers it loads or writes back.
+	//Thumb loads and stores only write the low registers and sp, ARM ones (LDRD/STRD, VFP) Rn, Rd and Rd + 1.
+
+	template<bool isThumb>
+	struct Rollback {
+
+		static constexpr usz count = isThumb ? 9 : 3;
+
+		u32 pc, ir, nir;
+		PSR cpsr;
+		u32 *at[count];
+		u32 value[count];
+
+		__forceinline Rollback(Registers &r, const u8 *m): pc(r.pc), ir(r.ir), nir(r.nir), cpsr(r.cpsr) {
+
+			if constexpr (isThumb) {
+
+				for (usz i = 0; i < 8; ++i)
+					at[i] = r.loReg + i;
 
+				at[8] = &r.reg(Register::sp);
+
+			} else {
+				at[0] = &r.registers[m[(ir >> 16) & 0xF]];
+				at[1] = &r.registers[m[(ir >> 12) & 0xF]];
+				at[2] = &r.registers[m[((ir >> 12) & 0xF) | 1]];
+			}
+
+			for (usz i = 0; i < count; ++i)
+				value[i] = *at[i];
+		}
+
+		//Aliases (Rn = Rd) saved the same value, so the order doesn't matter
+		__forceinline void restore(Registers &r) const {
+
+			for (usz i = 0; i < count; ++i)
+				*at[i] = value[i];
+
+			r.pc = pc;
+			r.ir = ir;
+			r.nir = nir;
+			r.cpsr = cpsr;
+		}
+	};
+
+	//Step under the protection unit; the instruction has to be executable and its data accesses allowed
+	//A denied data access rolls the instruction back (ARM9 base restored aborts) and raises a data abort.
+	//Stores before the denied access stay in memory, like a partially done STM.
+
+	template<bool isThumb, Armulator::Version v, Armulator::CycleModel model, typename Memory>
+	_inline_ bool protectedStep(Registers &r, Protected<Memory> &memory, const u8 *&hirMap, usz &cycles, Coprocessors *cp, usz &instructions) {
+
+		NoCycles none;
+		auto &t = timing<model>(cycles, none);
+
+		if (!memory.cp15.allows(Cp15::EXECUTE + memory.user, r.pc - (isThumb ? 4 : 8))) {
+			arm::exception<isThumb, Exception::PREFETCH_ABORT>(r, memory, t, hirMap);
+			++cycles;
+			++instructions;
+			return true;
+		}
+
+		const Rollback<isThumb> saved(r, hirMap);
+		const u8 *savedMap = hirMap;
+
+		memory.fault = false;
+
+		const bool refilled = step<isThumb, v, model>(r, memory, hirMap, cycles, 0, cp, instructions);
+
+		if (!memory.fault)
+			return refilled;
+
+		saved.restore(r);
+		hirMap = savedMap;
+		arm::exception<isThumb, Exception::DATA_ABORT>(r, memory, t, hirMap);
+		return true;
 	}
 
-	template<Armulator::Version v, Armulator::DebugType type>
-	_inline_ void wait(Registers &r, arm::Armulator::Memory &memory) {
+	//Run instructions until the pipeline is refilled (branch or exception)
+	//Thumb state can only change at the end of a block, so it is only checked once
+	//Pairs aren't fused while printing or for policies that see every fetch, those need every instruction
+
+	template<
+		bool isThumb, Armulator::Version v, Armulator::DebugType type, Armulator::CycleModel model,
+		typename Hooks, typename Memory
+	>
+	_inline_ void block(Registers &r, Memory &memory, const u8 *&hirMap, usz &cycles, u32 fused = 0, Coprocessors *cp = nullptr) {
+
+		if constexpr (hooksFetches<Hooks> || type != Armulator::NONE || isProtected<Memory>)
+			fused = 0;
+
+		bool refilled;
+		u32 start{};
+		usz startCycles{}, instructions{};
+
+		if constexpr (hasHooks<Hooks>) {
+			start = r.pc - (isThumb ? 4 : 8);
+			startCycles = cycles;
+		}
+
+		do {
+
+			if constexpr (hooksFetches<Hooks>)
+				Hooks::onFetch(r, r.pc - (isThumb ? 4 : 8), r.ir);
+
+			if constexpr ((type & Armulator::PRINT_INSTRUCTION) != 0 && isThumb)
+				thumb::printThumb<v>(r);
+
+			if constexpr (isProtected<Memory>)
+				refilled = protectedStep<isThumb, v, model>(r, memory, hirMap, cycles, cp, instructions);
+			else
+				refilled = step<isThumb, v, model>(r, memory, hirMap, cycles, fused, cp, instructions);
+
+			if constexpr ((type & Armulator::PRINT_REGISTERS) != 0)
+				Armulator::print(r);
+
+		} while (!refilled);
+
+		if constexpr (model == Armulator::CycleModel::APPROXIMATE)
+			cycles += 2;
+
+		//A block runs straight through until the instruction that refilled, so that's its last one
+
+		if constexpr (hasHooks<Hooks>) {
+			Hooks::onBlock(r, start | u32(isThumb), cycles - startCycles, instructions);
+			reportRefill<Hooks>(r, start + u32(instructions - 1) * (isThumb ? 2 : 4));
+		}
+	}
+
+	template<
+		Armulator::Version v, Armulator::DebugType type,
+		Armulator::CycleModel model = Armulator::CycleModel::EXACT, typename Hooks = NoHooks, typename Memory
+	>
+	_inline_ void block(Registers &r, Memory &memory, const u8 *&hirMap, usz &cycles, u32 fused = 0, Coprocessors *cp = nullptr) {
+
+		if constexpr (hooksAccesses<Hooks> && std::is_same_v<Memory, Armulator::Memory>) {
+			Probe<Hooks, Memory> probe{ memory };
+			block<v, type, model, Hooks>(r, probe, hirMap, cycles, 0, cp);
+			return;
+		}
+
+		//The protection unit only wraps memory while it's enabled; the mode can't change within a block
+
+		if constexpr ((v & Armulator::VersionSpec::P) != 0 && !isProtected<Memory>)
+			if (cp && cp->cp15.enabled()) {
+				Protected<Memory> protect{ memory, cp->cp15, r.cpsr.mode() == Mode::USR ? u32(Cp15::USER) : 0 };
+				block<v, type, model, Hooks>(r, protect, hirMap, cycles, 0, cp);
+				return;
+			}
+
+		if constexpr ((v & Armulator::VersionSpec::T) != 0) {
+
+			if (r.cpsr.thumb())
+				block<true, v, type, model, Hooks>(r, memory, hirMap, cycles, fused);
+			else
+				block<false, v, type, model, Hooks>(r, memory, hirMap, cycles, 0, cp);
+
+		} else
+			block<false, v, type, model, Hooks>(r, memory, hirMap, cycles, 0, cp);
+	}
+
+	//Fill the pipeline and get the high register mapping for the current mode
+
+	_inline_ const u8 *prefetch(Registers &r, arm::Armulator::Memory &memory) {
 
 		//High register mappings
 		u8 mid = Mode::toId(r.cpsr.mode());
@@ -71,30 +268,266 @@ namespace arm {
 			fetchNext<false>(r, memory);
 		}
 
+		return hirMap;
+	}
+
+	template<Armulator::Version v, Armulator::DebugType type>
+	_inline_ void wait(Registers &r, arm::Armulator::Memory &memory) {
+
+		const u8 *hirMap = prefetch(r, memory);
+
 		//Run instructions
 
 		usz cycles{};
 
-		while (true) {
+		while (true)
+			block<v, type>(r, memory, hirMap, cycles);
+	}
+
+	template<Armulator::Version v, Armulator::DebugType type, Armulator::CycleModel model, typename Hooks>
+	void Armulator::run(usz until) {
+
+		const u8 *hirMap;
+
+		if (!init) {
+			hirMap = prefetch(r, memory);
+			init = true;
+		} else
+			hirMap = r.getMapping();
+
+		target = until;
+		stopped = false;
+
+		//Exceptions entered between runs
+
+		if (raised)
+			report<Hooks>();
+
+		//The last run can end on a hooked entry (its block reached the target), so that hook runs first
 
-			if constexpr ((type & Armulator::PRINT_INSTRUCTION) != 0 && (v & Armulator::VersionSpec::T) != 0) {
-				if (r.cpsr.thumb())
-					printThumb<v>(r);
+		while (cycles < target && hooks.maybe(r.pc) && hook(hirMap))
+			;
+
+		while (cycles < target) {
+
+			block<v, type, model, Hooks>(r, memory, hirMap, cycles, fusion.pairs, &cp);
+
+			//Just entered the SWI vector; ir is the instruction at 0x08
+
+			if (swi && r.pc == (u32(Exception::SWI) & 0xFF) + 8 && !r.cpsr.thumb() && r.cpsr.mode() == Mode::SVC)
+				hle(hirMap);
+
+			//Hooks return to lr, which could be hooked as well (unless a hook stopped the run)
+
+			while (cycles < target && hooks.maybe(r.pc) && hook(hirMap))
+				;
+
+			//A run stopped by a hook (like the sentinel of call) returns right away;
+			//due events and interrupts wait for the next run
+
+			if (stopped)
+				break;
+
+			//An interrupt that is taken at this boundary ends the loop, so there's nothing to skip
+
+			if (idle.enabled && !interruptible())
+				idle.skip(r, memory, cycles, scheduler.next() < target ? scheduler.next() : target);
+
+			//Events can raise exceptions, which changes the register mapping
+
+			if (cycles >= scheduler.next()) {
+				scheduler.dispatch(*this, cycles);
+				hirMap = r.getMapping();
 			}
 
-			if constexpr ((v & Armulator::VersionSpec::T) != 0) {
+			if (pending.load(std::memory_order_relaxed)) {
+				interrupt<Hooks>();
+				hirMap = r.getMapping();
+			}
 
-				if (r.cpsr.thumb())
-					step<true, v>(r, memory, hirMap, cycles);
-				else
-					step<false, v>(r, memory, hirMap, cycles);
+			//Exceptions entered outside of the instructions; by events, host hooks, SWI handlers or interrupts
 
-			} else
-				step<false, v>(r, memory, hirMap, cycles);
+			if (raised)
+				report<Hooks>();
+		}
+	}
 
-			if constexpr ((type & Armulator::PRINT_REGISTERS) != 0)
-				Armulator::print(r);
+	template<Armulator::Version v, typename Hooks, Armulator::CycleModel model, typename ...Args>
+	u64 Armulator::call(u32 address, Args ...args) {
+
+		static_assert((std::is_convertible_v<Args, u32> && ...), "Call arguments have to be words");
+
+		const u32 words[sizeof...(Args) + 1] = { u32(args)... };
+		constexpr usz count = sizeof...(Args);
+
+		//The sentinel stops the run and loops on itself, so the hook can't chain into guest code
+
+		if (!hooks.find(HostHooks::key(sentinel | 1)))
+			hooks.add(sentinel | 1, [](Armulator &arm, void*) {
+				arm.stop();
+				arm.r.reg(Register::lr) = arm.sentinel | 1;
+			});
+
+		//The function can switch modes or return in the other state, so the caller's state is kept aside
+
+		const PSR cpsr = r.cpsr;
+		const u32 pc = r.pc, ir = r.ir, nir = r.nir;
+		const bool filled = init;
+
+		u32 &stack = r.reg(Register::sp);
+		const u32 sp = stack;
+
+		//Stack arguments; sp stays 8-byte aligned
+
+		if constexpr (count > 4) {
+
+			stack = (sp - u32(count - 4) * 4) & ~7;
+
+			for (usz i = 4; i < count; ++i)
+				memory.set(u32(stack + (i - 4) * 4), words[i]);
+		}
+
+		for (usz i = 0; i < count && i < 4; ++i)
+			r.loReg[i] = words[i];
+
+		r.reg(Register::lr) = sentinel | 1;
+
+		if (address & 1) {
+			r.cpsr.setThumb();
+			r.pc = address & ~1;
+		} else {
+			r.cpsr.clearThumb();
+			r.pc = address & ~3;
 		}
+
+		//The pipeline is filled at the start of the run
+
+		init = false;
+		run<v, NONE, model, Hooks>(Scheduler::never);
+
+		stack = sp;
+		r.cpsr = cpsr;
+		r.pc = pc;
+		r.ir = ir;
+		r.nir = nir;
+		init = filled;
+
+		return u64(r.loReg[0]) | (u64(r.loReg[1]) << 32);
+	}
+
+	template<typename Hooks>
+	void Armulator::interrupt() {
+
+		const u32 p = pending.load(std::memory_order_acquire);
+
+		if ((p & FIQ) && !r.cpsr.disableFIQ()) {
+			pending.fetch_and(~u32(FIQ), std::memory_order_acq_rel);
+			exception<Exception::FIQ>();
+		}
+
+		else if ((p & IRQ) && !r.cpsr.disableIRQ()) {
+			pending.fetch_and(~u32(IRQ), std::memory_order_acq_rel);
+			exception<Exception::IRQ>();
+		}
+	}
+
+	bool Armulator::hle(const u8 *&hirMap) {
+
+		const PSR saved = r.spsr[Mode::toId(Mode::SVC)];
+		const u32 link = r.registers[Registers::mapping[Mode::toId(Mode::SVC)][Register::lr]];
+
+		//The comment field is in the low byte in thumb mode and bit 16-23 in arm mode (like the BIOS reads it)
+
+		const u8 comment = saved.thumb() ?
+			u8(memory.get<u16>(link - 2)) :
+			u8(memory.get<u32>(link - 4) >> 16);
+
+		const SwiTable::Handler handler = swi->handlers[comment];
+
+		if (!handler)
+			return false;
+
+		//Handlers only use r0-r3 which aren't banked
+
+		cycles += handler(*this);
+
+		//Return like MOVS pc, lr
+
+		r.cpsr = saved;
+		r.pc = link;
+		hirMap = prefetch(r, memory);
+		cycles += 2;
+		return true;
+	}
+
+	bool Armulator::hook(const u8 *&hirMap) {
+
+		const HostHooks::Hook *h = hooks.find(r.pc | u32(r.cpsr.thumb()));
+
+		if (!h)
+			return false;
+
+		h->callback(*this, h->user);
+		cycles += h->cycles;
+
+		//Return like BX lr
+
+		const u32 link = r.reg(Register::lr);
+
+		if (link & 1) {
+			r.cpsr.setThumb();
+			r.pc = link & ~1;
+		} else {
+			r.cpsr.clearThumb();
+			r.pc = link & ~3;
+		}
+
+		hirMap = prefetch(r, memory);
+		cycles += 2;
+		return true;
+	}
+
+	template<Exception e>
+	bool Armulator::exception() {
+
+		bool entered;
+
+		//The pipeline is filled by the first run
+
+		if (!init)
+			entered = r.exception<e>();
+
+		else {
+
+			const u8 *m = r.getMapping();
+
+			if (r.cpsr.thumb())
+				entered = arm::exception<true, e>(r, memory, cycles, m);
+			else
+				entered = arm::exception<false, e>(r, memory, cycles, m);
+		}
+
+		//Reported to the instrumentation at the next block boundary of a run (see report)
+
+		if (entered)
+			raised |= u8(1 << ((u32(e) & 0xFF) >> 2));
+
+		return entered;
+	}
+
+	template<typename Hooks>
+	void Armulator::report() {
+
+		if constexpr (hasHooks<Hooks>)
+			for (u32 i = 0; i < 8; ++i) {
+
+				Exception e;
+
+				if (((raised >> i) & 1) && vectorException(i * 4, e))
+					Hooks::onException(r, e);
+			}
+
+		raised = 0;
 	}
 
 }
\ No newline at end of file
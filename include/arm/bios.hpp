@@ -0,0 +1,341 @@
+#pragma once
+#include "armulator.hpp"
+
+namespace arm {
+
+	//High level emulation (HLE) of BIOS services
+	//When the run loop sees the pipeline was refilled at the SWI vector, it looks up the SWI's comment field.
+	//If there's a handler it runs natively and the exception is returned from immediately;
+	//otherwise the guest's BIOS handles it (LLE). Clearing Armulator::swi (or an entry) selects LLE again.
+	//Registers and memory match the BIOS routine; the cycles returned are an estimate of the routine's cost.
+
+	struct SwiTable {
+
+		//Returns the cycles the BIOS routine would take
+		using Handler = usz (*)(Armulator &arm);
+
+		Handler handlers[256]{};
+
+	};
+
+	namespace bios {
+
+		//Helpers
+
+		__forceinline u32 &reg(Armulator &arm, usz i) {
+			return arm.r.loReg[i];
+		}
+
+		//Output of the decompression routines; written to the destination in the unit the routine uses
+		//(8-bit for the WRAM variants, 16-bit for the VRAM variants)
+
+		template<typename Unit>
+		__forceinline void write(Armulator &arm, u32 dst, const List<u8> &out) {
+
+			for (usz i = 0; i + sizeof(Unit) <= out.size(); i += sizeof(Unit)) {
+
+				Unit u{};
+
+				for (usz j = 0; j < sizeof(Unit); ++j)
+					u |= Unit(out[i + j] << (j * 8));
+
+				arm.memory.set(u32(dst + i), u);
+			}
+		}
+
+		//Header of compressed data; decompressed size is bits 8-31
+		__forceinline u32 decompressedSize(Armulator &arm, u32 src) {
+			return arm.memory.get<u32>(src) >> 8;
+		}
+
+		//Division; r0 = r0 / r1, r1 = r0 % r1, r3 = abs(r0 / r1)
+		//Division by zero returns +-1 like the BIOS' early out does
+
+		inline usz div(Armulator &arm) {
+
+			const i32 n = i32(reg(arm, 0)), d = i32(reg(arm, 1));
+
+			if (d == 0) {
+				reg(arm, 0) = n < 0 ? u32(-1) : 1;
+				reg(arm, 1) = u32(n);
+				reg(arm, 3) = 1;
+				return 20;
+			}
+
+			//i32 min / -1 overflows; the BIOS wraps
+
+			const i32 q = i32(i64(n) / d), m = i32(i64(n) % d);
+			const u32 abs = q < 0 ? u32(-i64(q)) : u32(q);
+
+			reg(arm, 0) = u32(q);
+			reg(arm, 1) = u32(m);
+			reg(arm, 3) = abs;
+
+			//The BIOS subtracts shifted denominators; one iteration per quotient bit
+
+			usz bits{};
+
+			for (u32 t = abs; t; t >>= 1)
+				++bits;
+
+			return 30 + 4 * bits;
+		}
+
+		//Same as div with r0 and r1 swapped
+		inline usz divArm(Armulator &arm) {
+			std::swap(reg(arm, 0), reg(arm, 1));
+			return div(arm) + 4;
+		}
+
+		//r0 = u16(sqrt(u32(r0)))
+		inline usz sqrt(Armulator &arm) {
+
+			u32 v = reg(arm, 0), res{}, bit = 1 << 30;
+
+			while (bit > v)
+				bit >>= 2;
+
+			while (bit) {
+
+				if (v >= res + bit) {
+					v -= res + bit;
+					res = (res >> 1) + bit;
+				} else
+					res >>= 1;
+
+				bit >>= 2;
+			}
+
+			reg(arm, 0) = res;
+			return 120;
+		}
+
+		//Copy or fill; r0 = src, r1 = dst, r2 = count (bit 0-20) | fill (bit 24) | 32-bit units (bit 26)
+
+		inline usz cpuSet(Armulator &arm) {
+
+			const u32 ctrl = reg(arm, 2), count = ctrl & 0x1FFFFF;
+			const bool fill = ctrl & (1 << 24);
+
+			if (ctrl & (1 << 26)) {
+
+				u32 src = reg(arm, 0) & ~3, dst = reg(arm, 1) & ~3;
+				const u32 value = arm.memory.get<u32>(src);
+
+				for (u32 i = 0; i < count; ++i, dst += 4)
+					arm.memory.set(dst, fill ? value : arm.memory.get<u32>(src + i * 4));
+
+			} else {
+
+				u32 src = reg(arm, 0) & ~1, dst = reg(arm, 1) & ~1;
+				const u16 value = arm.memory.get<u16>(src);
+
+				for (u32 i = 0; i < count; ++i, dst += 2)
+					arm.memory.set(dst, fill ? value : arm.memory.get<u16>(src + i * 2));
+			}
+
+			return 20 + usz(count) * (fill ? 4 : 7);
+		}
+
+		//Copy or fill in blocks of 8 words (LDMIA/STMIA in the BIOS); r2 = count (bit 0-20) | fill (bit 24)
+
+		inline usz cpuFastSet(Armulator &arm) {
+
+			const u32 ctrl = reg(arm, 2), count = ((ctrl & 0x1FFFFF) + 7) & ~7;
+			const bool fill = ctrl & (1 << 24);
+
+			const u32 src = reg(arm, 0) & ~3, dst = reg(arm, 1) & ~3;
+
+			if (fill) {
+
+				const u32 value = arm.memory.get<u32>(src);
+
+				for (u32 i = 0; i < count; ++i)
+					arm.memory.set(dst + i * 4, value);
+
+			} else for (u32 i = 0; i < count; i += 8) {
+
+				u32 block[8];
+
+				for (u32 j = 0; j < 8; ++j)
+					block[j] = arm.memory.get<u32>(src + (i + j) * 4);
+
+				for (u32 j = 0; j < 8; ++j)
+					arm.memory.set(dst + (i + j) * 4, block[j]);
+			}
+
+			return 20 + usz(count) * (fill ? 1 : 2);
+		}
+
+		//LZ77; flags byte for 8 blocks (MSB first), 1 = 2 byte reference (disp: 12-bit + 1, length: 4-bit + 3)
+
+		template<typename Unit>
+		inline usz lz77(Armulator &arm) {
+
+			u32 src = reg(arm, 0);
+			const u32 size = decompressedSize(arm, src);
+			src += 4;
+
+			List<u8> out;
+			out.reserve(size + 1);
+
+			while (out.size() < size) {
+
+				const u8 flags = arm.memory.get<u8>(src++);
+
+				for (u32 i = 0; i < 8 && out.size() < size; ++i) {
+
+					if (!(flags & (0x80 >> i))) {
+						out.push_back(arm.memory.get<u8>(src++));
+						continue;
+					}
+
+					const u8 b0 = arm.memory.get<u8>(src), b1 = arm.memory.get<u8>(src + 1);
+					src += 2;
+
+					const usz disp = (usz(b0 & 0xF) << 8 | b1) + 1, len = usz(b0 >> 4) + 3;
+
+					if (disp > out.size())		//Corrupt data; the BIOS would read before the output
+						return 40 + out.size() * 8;
+
+					for (usz j = 0; j < len && out.size() < size; ++j)
+						out.push_back(out[out.size() - disp]);
+				}
+			}
+
+			//VRAM is written in halfwords; an odd tail is padded (wram output stops at size)
+
+			if constexpr (std::is_same_v<Unit, u16>)
+				if (out.size() & 1)
+					out.push_back(0);
+
+			write<Unit>(arm, reg(arm, 1), out);
+			return 40 + usz(size) * 8;
+		}
+
+		//Run length; flag bit 7 = run of (flag & 0x7F) + 3 of the next byte, else (flag & 0x7F) + 1 literal bytes
+
+		template<typename Unit>
+		inline usz runLength(Armulator &arm) {
+
+			u32 src = reg(arm, 0);
+			const u32 size = decompressedSize(arm, src);
+			src += 4;
+
+			List<u8> out;
+			out.reserve(size + 1);
+
+			while (out.size() < size) {
+
+				const u8 flag = arm.memory.get<u8>(src++);
+
+				if (flag & 0x80) {
+
+					const u8 value = arm.memory.get<u8>(src++);
+
+					for (usz i = 0, len = usz(flag & 0x7F) + 3; i < len && out.size() < size; ++i)
+						out.push_back(value);
+
+				} else for (usz i = 0, len = usz(flag & 0x7F) + 1; i < len && out.size() < size; ++i)
+					out.push_back(arm.memory.get<u8>(src++));
+			}
+
+			if constexpr (std::is_same_v<Unit, u16>)
+				if (out.size() & 1)
+					out.push_back(0);
+
+			write<Unit>(arm, reg(arm, 1), out);
+			return 40 + usz(size) * 6;
+		}
+
+		//Huffman; header bit 0-3 = 4 or 8 bit data, followed by the tree size and the tree
+		//Node: bit 0-5 = offset to the children, bit 6 = right child is data, bit 7 = left child is data
+		//The bit stream is in 32-bit words, MSB first and the output is written in 32-bit words
+
+		inline usz huffman(Armulator &arm) {
+
+			const u32 src = reg(arm, 0), header = arm.memory.get<u32>(src);
+			const u32 size = header >> 8, bits = header & 0xF;
+
+			if (bits != 4 && bits != 8)
+				return 40;
+
+			const u32 tree = src + 4, root = tree + 1;
+			u32 stream = tree + (u32(arm.memory.get<u8>(tree)) + 1) * 2;
+
+			List<u8> out;
+			out.reserve(size + 3);
+
+			u32 node = root;
+			u8 pending{}, nibbles{};
+
+			while (out.size() < size) {
+
+				const u32 word = arm.memory.get<u32>(stream);
+				stream += 4;
+
+				for (u32 i = 0; i < 32 && out.size() < size; ++i) {
+
+					const u8 n = arm.memory.get<u8>(node);
+					const bool right = word & (0x80000000 >> i);
+
+					const u32 child = (node & ~1) + (n & 0x3F) * 2 + 2 + right;
+
+					if (!(n & (right ? 0x40 : 0x80))) {
+						node = child;
+						continue;
+					}
+
+					const u8 value = arm.memory.get<u8>(child);
+					node = root;
+
+					if (bits == 8)
+						out.push_back(value);
+
+					else {
+
+						pending |= u8((value & 0xF) << (nibbles * 4));
+
+						if (++nibbles == 2) {
+							out.push_back(pending);
+							pending = nibbles = 0;
+						}
+					}
+				}
+			}
+
+			while (out.size() & 3)
+				out.push_back(0);
+
+			write<u32>(arm, reg(arm, 1), out);
+			return 40 + usz(size) * 12;
+		}
+
+		//Service numbers for the GBA BIOS
+		inline void installGba(SwiTable &table) {
+			table.handlers[0x06] = div;
+			table.handlers[0x07] = divArm;
+			table.handlers[0x08] = sqrt;
+			table.handlers[0x0B] = cpuSet;
+			table.handlers[0x0C] = cpuFastSet;
+			table.handlers[0x11] = lz77<u8>;
+			table.handlers[0x12] = lz77<u16>;
+			table.handlers[0x13] = huffman;
+			table.handlers[0x14] = runLength<u8>;
+			table.handlers[0x15] = runLength<u16>;
+		}
+
+		//Service numbers for the NDS BIOS (ARM7 and ARM9)
+		//The callback based decompressors (0x12, 0x13, 0x15) call back into the guest and stay LLE
+		inline void installNds(SwiTable &table) {
+			table.handlers[0x09] = div;
+			table.handlers[0x0B] = cpuSet;
+			table.handlers[0x0C] = cpuFastSet;
+			table.handlers[0x0D] = sqrt;
+			table.handlers[0x11] = lz77<u8>;
+			table.handlers[0x14] = runLength<u8>;
+		}
+
+	}
+
+}
\ No newline at end of file
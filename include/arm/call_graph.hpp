@@ -0,0 +1,329 @@
+#pragma once
+#include "instrumentation.hpp"
+#include "symbols.hpp"
+#include <unordered_map>
+#include <cstdio>
+
+namespace arm {
+
+	//Guest call graph; inclusive and exclusive cycles per function and a timeline of calls
+	//The run loop fills it through the CallProfile policy for the thread's attached call graph.
+	//A shadow call stack is pushed on BL/BLX and popped by indirect branches (BX, POP {pc}, MOV pc / LDM pc in ARM)
+	//that return to a frame on the stack. Returns that don't go through the link (longjmp, exception unwinding)
+	//are caught by resynchronizing on sp: frames of the current mode that lie below sp have returned.
+	//Interrupt handlers aren't separate frames; their cycles count towards the interrupted function.
+
+	struct CallGraph {
+
+		struct Function {
+			u32 address;			//Entry; bit 0 set for thumb
+			u64 calls;
+			u64 inclusive;			//Cycles from call to return; recursion is only counted once
+			u64 exclusive;			//Cycles in the function itself
+		};
+
+		//A finished call, for the timeline
+		struct Call {
+			u32 address;
+			u32 depth;
+			u64 start;				//Cycles since attach
+			u64 duration;
+		};
+
+		//Calls kept for the timeline; the aggregates are kept regardless
+		usz maxCalls = 1 << 20;
+
+		//Record the calling thread's blocks into this call graph (until detach)
+		__forceinline void attach() { current = this; }
+		static __forceinline void detach() { current = nullptr; }
+
+		static inline thread_local CallGraph *current{};
+
+		//Called by the policy
+
+		__forceinline void advance(usz cycles) { now += cycles; }
+		void call(const Registers &r, u32 address, u32 link);
+		void ret(const Registers &r, u32 address);
+		void resync(const Registers &r);
+
+		//Returns every frame that's still open (as if it returned now)
+		void finish();
+
+		void clear();
+
+		//Functions sorted by inclusive cycles
+		List<Function> functions() const;
+
+		__forceinline const List<Call> &calls() const { return timeline; }
+		__forceinline usz dropped() const { return droppedCalls; }
+		__forceinline usz depth() const { return stack.size(); }
+
+		//Text report: inclusive, exclusive, calls, function
+		void report(std::FILE *out, const Symbols *symbols = nullptr, usz top = 50) const;
+
+		//Chrome trace event JSON (chrome://tracing, Perfetto); cycles are converted with the clock in MHz
+		void chromeTrace(std::FILE *out, const Symbols *symbols = nullptr, f64 mhz = 16.777216) const;
+
+		//Opcode of the last instruction; the policy decodes it when the block ends
+		u32 lastIr{};
+		bool lastThumb{};
+
+	private:
+
+		struct Counts : Function {
+			u32 active;				//Frames on the stack
+		};
+
+		struct Frame {
+			u32 address, link, sp;
+			u8 mode;
+			u64 start, children;
+			Counts *counts;
+		};
+
+		List<Frame> stack;
+		List<Call> timeline;
+		std::unordered_map<u32, Counts> table;
+
+		u64 now{};
+		usz droppedCalls{};
+
+		void pop();
+
+		static void name(const Symbols *symbols, u32 address, c8 *buffer, usz size);
+
+	};
+
+	//Instrumentation policy that builds CallGraph::current
+
+	struct CallProfile : NoHooks {
+
+		enum Kind : u8 {
+			OTHER,
+			CALL,
+			INDIRECT
+		};
+
+		//Decode the instruction that refilled the pipeline
+
+		static __forceinline Kind classify(u32 ir, bool thumb) {
+
+			if (thumb) {
+
+				const u32 op = ir >> 11;
+
+				if (op == 0b11111 || op == 0b11101)						//BL, BLX
+					return CALL;
+
+				if ((ir & 0xFF80) == 0x4780)							//BLX Rm
+					return CALL;
+
+				if ((ir & 0xFF80) == 0x4700 || (ir & 0xFF00) == 0xBD00 || (ir & 0xFF87) == 0x4687)
+					return INDIRECT;									//BX Rm, POP {pc}, MOV pc, Rm
+
+				return OTHER;
+			}
+
+			if ((ir & 0xFE000000) == 0xFA000000)						//BLX label
+				return CALL;
+
+			if ((ir >> 28) == 0xF)
+				return OTHER;
+
+			if ((ir & 0x0F000000) == 0x0B000000 || (ir & 0x0FFFFFF0) == 0x012FFF30)
+				return CALL;											//BL, BLX Rm
+
+			if (
+				(ir & 0x0FFFFFF0) == 0x012FFF10 ||						//BX Rm
+				(ir & 0x0E108000) == 0x08108000 ||						//LDM {.., pc}
+				(ir & 0x0DEFF000) == 0x01A0F000							//MOV pc, op2
+			)
+				return INDIRECT;
+
+			return OTHER;
+		}
+
+		static __forceinline void onFetch(const Registers &r, u32, u32 ir) {
+			if (CallGraph *g = CallGraph::current) {
+				g->lastIr = ir;
+				g->lastThumb = r.cpsr.thumb();
+			}
+		}
+
+		static __forceinline void onBlock(const Registers&, u32, usz cycles, usz) {
+			if (CallGraph *g = CallGraph::current)
+				g->advance(cycles);
+		}
+
+		static __forceinline void onBranch(const Registers &r, u32 from, u32 to) {
+
+			CallGraph *g = CallGraph::current;
+
+			if (!g)
+				return;
+
+			const u32 target = to | u32(r.cpsr.thumb());
+
+			switch (classify(g->lastIr, g->lastThumb)) {
+
+				case CALL:
+					g->call(r, target, g->lastThumb ? (from + 4) | 1 : from + 4);
+					break;
+
+				case INDIRECT:
+					g->ret(r, target);
+					break;
+
+				default:
+					g->resync(r);
+			}
+		}
+
+	};
+
+	inline void CallGraph::call(const Registers &r, u32 address, u32 link) {
+
+		resync(r);
+
+		Counts &c = table.try_emplace(address, Counts{ { address, 0, 0, 0 }, 0 }).first->second;
+		++c.calls;
+		++c.active;
+
+		stack.push_back({ address, link, r.reg(Register::sp), Mode::toId(r.cpsr.mode()), now, 0, &c });
+	}
+
+	//Unwind to the frame that returns to the address; a branch through a register that doesn't is a tail call
+
+	inline void CallGraph::ret(const Registers &r, u32 address) {
+
+		for (usz i = stack.size(); i > 0; --i)
+			if (stack[i - 1].link == address) {
+
+				while (stack.size() >= i)
+					pop();
+
+				break;
+			}
+
+		resync(r);
+	}
+
+	inline void CallGraph::resync(const Registers &r) {
+
+		const u32 sp = r.reg(Register::sp);
+		const u8 mode = Mode::toId(r.cpsr.mode());
+
+		while (!stack.empty() && stack.back().mode == mode && stack.back().sp < sp)
+			pop();
+	}
+
+	inline void CallGraph::pop() {
+
+		const Frame f = stack.back();
+		stack.pop_back();
+
+		const u64 duration = now - f.start;
+		Counts &c = *f.counts;
+
+		c.exclusive += duration - f.children;
+
+		if (!--c.active)
+			c.inclusive += duration;
+
+		if (!stack.empty())
+			stack.back().children += duration;
+
+		if (timeline.size() < maxCalls)
+			timeline.push_back({ f.address, u32(stack.size()), f.start, duration });
+		else
+			++droppedCalls;
+	}
+
+	inline void CallGraph::finish() {
+		while (!stack.empty())
+			pop();
+	}
+
+	inline void CallGraph::clear() {
+		stack.clear();
+		timeline.clear();
+		table.clear();
+		now = 0;
+		droppedCalls = 0;
+	}
+
+	inline List<CallGraph::Function> CallGraph::functions() const {
+
+		List<Function> result;
+		result.reserve(table.size());
+
+		for (auto &kv : table)
+			result.push_back(kv.second);
+
+		std::sort(result.begin(), result.end(), [](const Function &a, const Function &b) {
+			return a.inclusive != b.inclusive ? a.inclusive > b.inclusive : a.address < b.address;
+		});
+
+		return result;
+	}
+
+	inline void CallGraph::name(const Symbols *symbols, u32 address, c8 *buffer, usz size) {
+		if (symbols)
+			symbols->name(address & ~1, buffer, size);
+		else
+			std::snprintf(buffer, size, "0x%08X", address & ~1);
+	}
+
+	inline void CallGraph::report(std::FILE *out, const Symbols *symbols, usz top) const {
+
+		const List<Function> list = functions();
+		c8 buffer[256];
+
+		std::fprintf(out, "%16s %16s %12s %s\n", "inclusive", "exclusive", "calls", "function");
+
+		for (usz i = 0; i < list.size() && i < top; ++i) {
+
+			const Function &f = list[i];
+			name(symbols, f.address, buffer, sizeof(buffer));
+
+			std::fprintf(
+				out, "%16llu %16llu %12llu %s%s\n",
+				(unsigned long long) f.inclusive, (unsigned long long) f.exclusive,
+				(unsigned long long) f.calls, buffer, f.address & 1 ? " (thumb)" : ""
+			);
+		}
+	}
+
+	inline void CallGraph::chromeTrace(std::FILE *out, const Symbols *symbols, f64 mhz) const {
+
+		c8 buffer[256], escaped[512];
+
+		std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+		for (usz i = 0; i < timeline.size(); ++i) {
+
+			const Call &c = timeline[i];
+			name(symbols, c.address, buffer, sizeof(buffer));
+
+			usz j{};
+
+			for (const c8 *s = buffer; *s && j + 2 < sizeof(escaped); ++s) {
+
+				if (*s == '"' || *s == '\\')
+					escaped[j++] = '\\';
+
+				escaped[j++] = *s;
+			}
+
+			escaped[j] = '\0';
+
+			std::fprintf(
+				out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0}",
+				i ? "," : "", escaped, c.address & 1 ? "thumb" : "arm", c.start / mhz, c.duration / mhz
+			);
+		}
+
+		std::fprintf(out, "\n]}\n");
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,860 @@
+#pragma once
+#include "armulator.hpp"
+#include "values.hpp"
+#include "thumb/opcodes.hpp"
+#include "thumb/values.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace arm {
+
+	//Control flow recovery of guest code (e.g. a ROM) before it runs
+	//Code is decoded from the entry points and the exception vectors, following B/BL/BLX/BX and the mode switches
+	//they do, and pc relative constants that end up in a BX or LDR pc (LDR r0, =func; BX r0).
+	//Runs of code are decoded by a pool of threads from a shared worklist; a run ends at the first branch, call or return.
+	//Runs are then split where another run starts, which gives the basic blocks, and the blocks are grouped into
+	//functions (blocks reached from an entry or BL target without following calls) with the calls between them.
+	//Indirect branches (BX lr, POP {pc}, jump tables) aren't followed, so code only reached through them is missed.
+	//
+	//Addresses have bit 0 set for thumb code.
+
+	struct ControlFlowGraph {
+
+		//Guest memory the code is read from
+		struct Region {
+			u32 start;
+			const u8 *data;
+			usz size;
+		};
+
+		enum Exit : u8 {
+			FALLTHROUGH,		//Another block starts at the end
+			BRANCH,				//B, or BX / LDR pc with a known target
+			CONDITIONAL,		//B{cond}
+			CALL,				//BL, BLX label
+			INDIRECT_CALL,		//BLX Rm
+			INDIRECT,			//BX Rm, POP {pc}, MOV pc, LDM {pc}; usually a return
+			INVALID				//Undefined instruction or the end of the regions
+		};
+
+		static constexpr u32 none = ~u32(0);
+
+		struct Block {
+
+			u32 start, end;		//end is the address after the last instruction
+			u32 taken;			//Branch or call target; none if unknown
+			u32 next;			//Where execution continues if it doesn't branch (or after a call); none if it can't
+			u32 function;		//Entry of the first function that reaches the block; none if none does
+			Exit exit;
+
+			__forceinline bool thumb() const { return start & 1; }
+			__forceinline u32 address() const { return start & ~1; }
+			__forceinline u32 size() const { return end - address(); }
+		};
+
+		struct Function {
+			u32 entry;
+			u32 blocks;			//Blocks reached from the entry without following calls
+			u32 size;			//Bytes in those blocks
+		};
+
+		struct Call {
+			u32 site;			//Address of the call instruction
+			u32 caller;			//Entry of the calling function
+			u32 callee;			//none for indirect calls
+		};
+
+		//Sorted by start, entry and (caller, site)
+		List<Block> blocks;
+		List<Function> functions;
+		List<Call> calls;
+
+		//Decode the code reachable from the entries and the exception vectors (if a region contains them)
+		//threads = 0 uses the hardware concurrency
+		template<Armulator::Version v>
+		void analyze(const List<Region> &regions, const List<u32> &entries, usz threads = 0);
+
+		void clear() {
+			blocks.clear();
+			functions.clear();
+			calls.clear();
+		}
+
+		//Block that contains the address (bit 0 selects thumb); nullptr if it isn't known code
+		const Block *find(u32 address) const;
+
+		//Function that starts at the entry; nullptr if there's none
+		const Function *function(u32 entry) const;
+
+		//Calls made by / made to a function
+		void callees(u32 caller, List<Call> &out) const;
+		void callers(u32 callee, List<Call> &out) const;
+
+		//Binary format; "ACFG", u32 version, u32 counts of blocks, functions and calls, followed by them (little endian)
+		void serialize(List<u8> &out) const;
+
+		//Returns false (and leaves the graph empty) if the data isn't a graph of this version
+		bool deserialize(const u8 *data, usz size);
+
+		static constexpr u32 magic = 0x47464341;		//ACFG
+		static constexpr u32 version = 1;
+
+	private:
+
+		static constexpr u32 maxRun = 1 << 16;		//Bytes decoded in one run before it's split up
+
+		struct Reader {
+
+			const List<Region> &regions;
+			const Region *last{};
+
+			bool read(u32 address, u32 size, u32 &v) {
+
+				if (!last || address - last->start + size > last->size) {
+
+					last = nullptr;
+
+					for (const Region &region : regions)
+						if (address >= region.start && address - region.start + size <= region.size) {
+							last = &region;
+							break;
+						}
+
+					if (!last)
+						return false;
+				}
+
+				const u8 *ptr = last->data + (address - last->start);
+				v = 0;
+
+				for (u32 i = 0; i < size; ++i)
+					v |= u32(ptr[i]) << (i * 8);
+
+				return true;
+			}
+
+			__forceinline bool read16(u32 address, u32 &v) { return read(address, 2, v); }
+			__forceinline bool read32(u32 address, u32 &v) { return read(address, 4, v); }
+		};
+
+		//Addresses still to decode; every address is only queued once
+		struct Worklist {
+
+			std::mutex mutex;
+			std::condition_variable wake;
+			List<u32> pending;
+			std::unordered_set<u32> seen;
+			usz active{};
+
+			void push(u32 address) {
+
+				address = address & 1 ? address : address & ~3;
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (seen.insert(address).second) {
+					pending.push_back(address);
+					wake.notify_one();
+				}
+			}
+
+			//Returns false once there's nothing left to decode and no thread can add more
+			bool pop(u32 &address) {
+
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return !pending.empty() || !active; });
+
+				if (pending.empty())
+					return false;
+
+				address = pending.back();
+				pending.pop_back();
+				++active;
+				return true;
+			}
+
+			void done() {
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (!--active && pending.empty())
+					wake.notify_all();
+			}
+		};
+
+		//Target of BX (and interworking loads); bit 0 selects thumb
+		static __forceinline u32 interwork(u32 target) { return target & 1 ? target : target & ~3; }
+
+		template<Armulator::Version v>
+		static Block runThumb(Reader &mem, u32 start);
+
+		template<Armulator::Version v>
+		static Block runArm(Reader &mem, u32 start);
+
+		void build(List<Block> &runs, List<u32> &roots);
+
+		usz index(u32 start) const;
+
+	};
+
+	template<Armulator::Version v>
+	ControlFlowGraph::Block ControlFlowGraph::runThumb(Reader &mem, u32 start) {
+
+		using namespace thumb;
+
+		static constexpr bool v5 = (v & 0xFF) >= Armulator::VersionSpec::v5;
+
+		Block b{ start | 1, start, none, none, none, INVALID };
+
+		//Low registers that hold a pc relative constant
+
+		u32 known[8]{};
+		u32 valid{};
+
+		for (u32 a = start; a - start < maxRun; ) {
+
+			u32 ir, nir = 0;
+
+			if (!mem.read16(a, ir))
+				return b;
+
+			const bool hasNext = mem.read16(a + 2, nir);
+
+			struct { u32 ir, nir; } r{ ir, nir };
+
+			switch (Op5_11) {
+
+				case LDR_PC:
+				case ADD_PC:
+				{
+					const u32 address = ((a + 4) & ~3) + i8_0_2;
+					u32 value = address;
+
+					valid &= ~(1u << Rd3_8);
+
+					if (Op5_11 == ADD_PC || mem.read32(address, value)) {
+						known[Rd3_8] = value;
+						valid |= 1u << Rd3_8;
+					}
+
+					break;
+				}
+
+				case B:
+					b.end = a + 2;
+					b.exit = BRANCH;
+					b.taken = (a + 4 + s12) | 1;
+					return b;
+
+				case B0:
+				case B1:
+
+					if (Op8_8 == SWI)
+						break;
+
+					b.end = a + 2;
+					b.taken = (a + 4 + (u32(i8(i8_0)) << 1)) | 1;
+
+					if (Op8_8 == BAL)
+						b.exit = BRANCH;
+
+					else {
+						b.exit = CONDITIONAL;
+						b.next = (a + 2) | 1;
+					}
+
+					return b;
+
+				case PUSH_POP:
+
+					if (Op8_8 == POP) {
+						valid = 0;
+						break;
+					}
+
+					if (Op8_8 == BKPT && v5)
+						break;
+
+					if (Op8_8 == POP_PC) {
+						b.end = a + 2;
+						b.exit = INDIRECT;
+					}
+
+					return b;
+
+				case BLL:
+				case BLX:
+
+					if (!hasNext || (Op5_11 == BLX && !v5))
+						return b;
+
+					b.end = a + 4;
+					b.exit = CALL;
+					b.taken = Op5_11 == BLL ? (a + 4 + s23) | 1 : (a + 4 + s23) & ~3;
+					b.next = (a + 4) | 1;
+					return b;
+
+				case BLH:
+					return b;
+
+				case ALU_HI_BX:
+
+					switch (Op10_6) {
+
+						case BX_LO:
+
+							b.end = a + 2;
+
+							if (valid & (1u << Rs3_3)) {
+								b.exit = BRANCH;
+								b.taken = interwork(known[Rs3_3]);
+							}
+
+							else b.exit = INDIRECT;
+
+							return b;
+
+						case BX_HI:
+
+							b.end = a + 2;
+
+							if (Rs3_3 == HiReg::pc) {
+								b.exit = BRANCH;
+								b.taken = (a + 4) & ~3;
+							}
+
+							else b.exit = INDIRECT;
+
+							return b;
+
+						case ADD_HI_LO:
+						case ADD_HI_HI:
+						case MOV_HI_LO:
+						case MOV_HI_HI:
+
+							if (Rd3_0 == HiReg::pc) {
+								b.end = a + 2;
+								b.exit = INDIRECT;
+								return b;
+							}
+
+							break;
+
+						case ADD_LO_HI:
+						case MOV_LO_HI:
+						case CMP_LO_HI:
+						case CMP_HI_LO:
+						case CMP_HI_HI:
+							valid &= ~(1u << Rd3_0);
+							break;
+
+						default:
+
+							if (Op10_6 > MVN)
+								return b;
+
+							valid &= ~(1u << Rd3_0);
+					}
+
+					break;
+
+				case LDMIA:
+					valid = 0;
+					break;
+
+				default:
+
+					//Every other write to a low register is to Rd3_0 or Rd3_8
+					valid &= ~((1u << Rd3_0) | (1u << Rd3_8));
+			}
+
+			a += 2;
+			b.end = a;
+		}
+
+		//Long run; continue in another block
+
+		b.exit = FALLTHROUGH;
+		b.next = b.end | 1;
+		return b;
+	}
+
+	template<Armulator::Version v>
+	ControlFlowGraph::Block ControlFlowGraph::runArm(Reader &mem, u32 start) {
+
+		static constexpr bool v5 = (v & 0xFF) >= Armulator::VersionSpec::v5;
+
+		Block b{ start, start, none, none, none, INVALID };
+
+		//Registers that hold a pc relative constant
+
+		u32 known[16]{};
+		u32 valid{};
+
+		for (u32 a = start; a - start < maxRun; a += 4) {
+
+			u32 ir;
+
+			if (!mem.read32(a, ir))
+				return b;
+
+			struct { u32 ir; } r{ ir };
+
+			const bool always = Cond4_28 == cond::AL;
+
+			//The end of the block; conditional instructions can fall through
+
+			auto end = [&](Exit exit, u32 taken) {
+				b.end = a + 4;
+				b.exit = exit;
+				b.taken = taken;
+				b.next = always && exit != CALL && exit != INDIRECT_CALL ? none : a + 4;
+
+				if (!always && exit == BRANCH)
+					b.exit = CONDITIONAL;
+
+				return b;
+			};
+
+			//Unconditional instruction space; BLX label on v5, never executed on v4
+
+			if (Cond4_28 == 0xF) {
+
+				if (v5 && (ir & 0x0E000000) == 0x0A000000)
+					return end(CALL, (a + 8 + (u32(i32(ir << 8) >> 6)) + ((ir >> 23) & 2)) | 1);
+
+				b.end = a + 4;
+				continue;
+			}
+
+			//B, BL
+
+			if ((ir & 0x0E000000) == 0x0A000000)
+				return end(ir & 0x01000000 ? CALL : BRANCH, a + 8 + u32(i32(ir << 8) >> 6));
+
+			//BX Rm, BLX Rm
+
+			if ((ir & 0x0FFFFFD0) == 0x012FFF10) {
+
+				if (ir & 0x20)
+					return v5 ? end(INDIRECT_CALL, none) : b;
+
+				if (valid & (1u << Rm4_0))
+					return end(BRANCH, interwork(known[Rm4_0]));
+
+				return end(INDIRECT, none);
+			}
+
+			//Undefined
+
+			if ((ir & 0x0E000010) == 0x06000010)
+				return b;
+
+			//LDR pc; a constant if it's LDR pc, [pc, #i] (e.g. an exception vector)
+
+			if ((ir & 0x0C500000) == 0x04100000 && Rd4_12 == 0xF) {
+
+				u32 target;
+
+				if ((ir & 0x0F7F0000) == 0x051F0000) {
+
+					const u32 offset = ir & 0xFFF;
+
+					if (mem.read32(a + 8 + (ir & 0x00800000 ? offset : -offset), target))
+						return end(BRANCH, v5 ? interwork(target) : target & ~3);
+				}
+
+				return end(INDIRECT, none);
+			}
+
+			//LDM with pc
+
+			if ((ir & 0x0E108000) == 0x08108000)
+				return end(INDIRECT, none);
+
+			//Data processing into pc (except compares, multiplies and halfword transfers)
+
+			const bool dataProc = (ir & 0x0C000000) == 0 && (ir & 0x0E000090) != 0x00000090;
+			const u32 op = (ir >> 21) & 0xF;
+
+			if (dataProc && (op < 8 || op > 11) && Rd4_12 == 0xF)
+				return end(INDIRECT, none);
+
+			//Constants: LDR Rd, [pc, #i] and ADD/SUB Rd, pc, #i
+
+			valid &= ~((1u << Rd4_12) | (1u << Rn4_16));
+
+			if ((ir & 0x0E100000) == 0x08100000)
+				valid = 0;
+
+			else if (always && (ir & 0x0F7F0000) == 0x051F0000) {
+
+				const u32 offset = ir & 0xFFF;
+
+				if (mem.read32(a + 8 + (ir & 0x00800000 ? offset : -offset), known[Rd4_12]))
+					valid |= 1u << Rd4_12;
+			}
+
+			else if (always && ((ir & 0x0FEF0000) == 0x028F0000 || (ir & 0x0FEF0000) == 0x024F0000)) {
+
+				const u32 rot = (ir >> 7) & 0x1E, imm = ir & 0xFF;
+				const u32 offset = rot ? (imm >> rot) | (imm << (32 - rot)) : imm;
+
+				known[Rd4_12] = a + 8 + (op == 4 ? offset : -offset);
+				valid |= 1u << Rd4_12;
+			}
+
+			b.end = a + 4;
+		}
+
+		b.exit = FALLTHROUGH;
+		b.next = b.end;
+		return b;
+	}
+
+	template<Armulator::Version v>
+	void ControlFlowGraph::analyze(const List<Region> &regions, const List<u32> &entries, usz threads) {
+
+		clear();
+
+		static constexpr Exception vectors[] = {
+			Exception::RESET, Exception::UND, Exception::SWI, Exception::PREFETCH_ABORT,
+			Exception::DATA_ABORT, Exception::IRQ, Exception::FIQ
+		};
+
+		Worklist work;
+		List<u32> roots;
+
+		for (u32 entry : entries) {
+			roots.push_back(entry & 1 ? entry : entry & ~3);
+			work.push(entry);
+		}
+
+		Reader reader{ regions };
+
+		for (Exception e : vectors) {
+
+			u32 ir;
+			const u32 vector = u32(e) & 0xFF;
+
+			if (reader.read32(vector, ir)) {
+				roots.push_back(vector);
+				work.push(vector);
+			}
+		}
+
+		if (!threads)
+			threads = std::thread::hardware_concurrency();
+
+		if (!threads)
+			threads = 1;
+
+		//Every thread keeps its own runs; merged when the worklist is empty
+
+		List<List<Block>> found(threads);
+
+		auto worker = [&work, &regions, &found](usz t) {
+
+			Reader mem{ regions };
+			u32 address;
+
+			while (work.pop(address)) {
+
+				const Block b = address & 1 ? runThumb<v>(mem, address & ~1) : runArm<v>(mem, address);
+
+				if (b.end != b.address()) {
+
+					found[t].push_back(b);
+
+					if (b.taken != none)
+						work.push(b.taken);
+
+					if (b.next != none)
+						work.push(b.next);
+				}
+
+				work.done();
+			}
+		};
+
+		List<std::thread> pool;
+		pool.reserve(threads - 1);
+
+		for (usz t = 1; t < threads; ++t)
+			pool.emplace_back(worker, t);
+
+		worker(0);
+
+		for (std::thread &t : pool)
+			t.join();
+
+		List<Block> runs;
+
+		for (List<Block> &list : found)
+			runs.insert(runs.end(), list.begin(), list.end());
+
+		build(runs, roots);
+	}
+
+	inline void ControlFlowGraph::build(List<Block> &runs, List<u32> &roots) {
+
+		//Split the runs where another run starts (a branch into the middle of it)
+
+		List<u32> starts(runs.size());
+
+		for (usz i = 0; i < runs.size(); ++i)
+			starts[i] = runs[i].start;
+
+		std::sort(starts.begin(), starts.end());
+
+		for (const Block &run : runs) {
+
+			const u32 mode = run.start & 1;
+			u32 current = run.start;
+
+			for (
+				auto it = std::upper_bound(starts.begin(), starts.end(), run.start);
+				it != starts.end() && *it < run.end;
+				++it
+			) {
+
+				if ((*it & 1) != mode)
+					continue;
+
+				blocks.push_back({ current, *it & ~1, none, *it, none, FALLTHROUGH });
+				current = *it;
+			}
+
+			Block last = run;
+			last.start = current;
+			blocks.push_back(last);
+		}
+
+		//Runs that overlap give the same blocks; keep one (with a target if only one resolved a constant)
+
+		std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) {
+			return a.start < b.start || (a.start == b.start && a.taken != none && b.taken == none);
+		});
+
+		blocks.erase(
+			std::unique(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) { return a.start == b.start; }),
+			blocks.end()
+		);
+
+		//Functions start at the roots and at call targets
+
+		for (const Block &b : blocks)
+			if (b.exit == CALL)
+				roots.push_back(b.taken);
+
+		std::sort(roots.begin(), roots.end());
+		roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+
+		for (u32 entry : roots)
+			if (index(entry) != none)
+				functions.push_back({ entry, 0, 0 });
+
+		//Walk every function without following calls; a branch to another function is a tail call
+
+		List<u32> visited(blocks.size(), none), stack;
+
+		for (usz f = 0; f < functions.size(); ++f) {
+
+			Function &func = functions[f];
+
+			stack.push_back(u32(index(func.entry)));
+			visited[stack.back()] = u32(f);
+
+			while (!stack.empty()) {
+
+				Block &b = blocks[stack.back()];
+				stack.pop_back();
+
+				if (b.function == none)
+					b.function = func.entry;
+
+				++func.blocks;
+				func.size += b.size();
+
+				if (b.exit == CALL)
+					calls.push_back({ (b.end - 4) | (b.start & 1), func.entry, b.taken });
+
+				else if (b.exit == INDIRECT_CALL)
+					calls.push_back({ (b.end - (b.thumb() ? 2 : 4)) | (b.start & 1), func.entry, none });
+
+				const u32 taken = b.exit == BRANCH || b.exit == CONDITIONAL ? b.taken : none;
+
+				for (u32 target : { taken, b.next }) {
+
+					if (target == none || (target == taken && function(target)))
+						continue;
+
+					const usz i = index(target);
+
+					if (i != none && visited[i] != u32(f)) {
+						visited[i] = u32(f);
+						stack.push_back(u32(i));
+					}
+				}
+			}
+		}
+
+		std::sort(calls.begin(), calls.end(), [](const Call &a, const Call &b) {
+			return a.caller < b.caller || (a.caller == b.caller && a.site < b.site);
+		});
+	}
+
+	inline usz ControlFlowGraph::index(u32 start) const {
+
+		auto it = std::lower_bound(
+			blocks.begin(), blocks.end(), start, [](const Block &b, u32 address) { return b.start < address; }
+		);
+
+		return it != blocks.end() && it->start == start ? usz(it - blocks.begin()) : none;
+	}
+
+	inline const ControlFlowGraph::Block *ControlFlowGraph::find(u32 address) const {
+
+		auto it = std::upper_bound(
+			blocks.begin(), blocks.end(), address, [](u32 address, const Block &b) { return address < b.start; }
+		);
+
+		//Thumb and ARM blocks are sorted together; skip the ones of the other mode
+
+		while (it != blocks.begin()) {
+
+			const Block &b = *--it;
+
+			if ((b.start & 1) != (address & 1))
+				continue;
+
+			return (address & ~1) < b.end ? &b : nullptr;
+		}
+
+		return nullptr;
+	}
+
+	inline const ControlFlowGraph::Function *ControlFlowGraph::function(u32 entry) const {
+
+		auto it = std::lower_bound(
+			functions.begin(), functions.end(), entry, [](const Function &f, u32 address) { return f.entry < address; }
+		);
+
+		return it != functions.end() && it->entry == entry ? &*it : nullptr;
+	}
+
+	inline void ControlFlowGraph::callees(u32 caller, List<Call> &out) const {
+
+		auto it = std::lower_bound(
+			calls.begin(), calls.end(), caller, [](const Call &c, u32 address) { return c.caller < address; }
+		);
+
+		for (; it != calls.end() && it->caller == caller; ++it)
+			out.push_back(*it);
+	}
+
+	inline void ControlFlowGraph::callers(u32 callee, List<Call> &out) const {
+		for (const Call &c : calls)
+			if (c.callee == callee)
+				out.push_back(c);
+	}
+
+	inline void ControlFlowGraph::serialize(List<u8> &out) const {
+
+		auto put = [&out](u32 v) {
+			for (u32 i = 0; i < 4; ++i)
+				out.push_back(u8(v >> (i * 8)));
+		};
+
+		put(magic);
+		put(version);
+		put(u32(blocks.size()));
+		put(u32(functions.size()));
+		put(u32(calls.size()));
+
+		for (const Block &b : blocks) {
+			put(b.start);
+			put(b.end);
+			put(b.taken);
+			put(b.next);
+			put(b.function);
+			out.push_back(b.exit);
+		}
+
+		for (const Function &f : functions) {
+			put(f.entry);
+			put(f.blocks);
+			put(f.size);
+		}
+
+		for (const Call &c : calls) {
+			put(c.site);
+			put(c.caller);
+			put(c.callee);
+		}
+	}
+
+	inline bool ControlFlowGraph::deserialize(const u8 *data, usz size) {
+
+		clear();
+
+		const u8 *ptr = data, *end = data + size;
+
+		auto get = [&ptr, end](u32 &v) {
+
+			if (end - ptr < 4)
+				return false;
+
+			v = u32(ptr[0]) | (u32(ptr[1]) << 8) | (u32(ptr[2]) << 16) | (u32(ptr[3]) << 24);
+			ptr += 4;
+			return true;
+		};
+
+		u32 m, ver, blockCount, functionCount, callCount;
+
+		if (
+			!get(m) || !get(ver) || m != magic || ver != version ||
+			!get(blockCount) || !get(functionCount) || !get(callCount) ||
+			usz(end - ptr) != blockCount * 21ull + functionCount * 12ull + callCount * 12ull
+		)
+			return false;
+
+		blocks.resize(blockCount);
+		functions.resize(functionCount);
+		calls.resize(callCount);
+
+		for (Block &b : blocks) {
+
+			get(b.start);
+			get(b.end);
+			get(b.taken);
+			get(b.next);
+			get(b.function);
+
+			if (*ptr > INVALID) {
+				clear();
+				return false;
+			}
+
+			b.exit = Exit(*ptr++);
+		}
+
+		for (Function &f : functions) {
+			get(f.entry);
+			get(f.blocks);
+			get(f.size);
+		}
+
+		for (Call &c : calls) {
+			get(c.site);
+			get(c.caller);
+			get(c.callee);
+		}
+
+		return true;
+	}
+
+}
\ No newline at end of file
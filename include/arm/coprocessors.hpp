@@ -0,0 +1,15 @@
+#pragma once
+#include "vfp.hpp"
+#include "cp15.hpp"
+
+namespace arm {
+
+	//State of the coprocessors next to the core
+	//Only versions that have them (VersionSpec::VFP, VersionSpec::P) decode their instructions; the others take the undefined instruction trap
+
+	struct Coprocessors {
+		Vfp vfp;		//CP10/CP11
+		Cp15 cp15;		//Protection unit and TCM
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,242 @@
+#pragma once
+#include "arm/armulator_source.hpp"
+#include "arm/spsc_queue.hpp"
+#include <thread>
+
+namespace arm {
+
+	//Two armulators (e.g. an ARM9 with an ARM7) that share memory and an IPC FIFO
+	//Every core runs a quantum of cycles on its own; writes to shared memory and FIFO words are queued
+	//and only applied to the other core at the next quantum boundary.
+	//Guest stores to the shared range (see share) are captured through the SharedWrites instrumentation policy;
+	//while a range is set the cores run with it (memory is probed and thumb pairs aren't fused).
+	//The quantum is expressed in main cycles; the sub core runs quantum * subClock / mainClock cycles.
+	//A quantum of 0 would never advance time, so it's clamped to 1.
+	//Smaller quanta means tighter timing between the cores, at the cost of synchronizing more often.
+
+	template<
+		Armulator::Version mainV = Armulator::ARM9TDMI,
+		Armulator::Version subV = Armulator::ARM7TDMI,
+		usz queueSize = 4096
+	>
+	struct Coupled {
+
+		enum Core : u8 {
+			MAIN,
+			SUB
+		};
+
+		struct Message {
+
+			enum Type : u8 {
+				WRITE8,
+				WRITE16,
+				WRITE32,
+				FIFO
+			};
+
+			Type type;
+			u32 address;		//Ignored for FIFO
+			u32 value;
+		};
+
+		using Queue = SpscQueue<Message, queueSize>;
+
+		//Called on the receiving core's thread when a FIFO word arrives
+		using FifoCallback = void (*)(Armulator &receiver, Core core, u32 value, void *user);
+
+		Coupled(Armulator &main, Armulator &sub, usz quantum, u32 mainClock = 2, u32 subClock = 1):
+			cores{ &main, &sub }, quantum(quantum ? quantum : 1), mainClock(mainClock), subClock(subClock) {}
+
+		Coupled(const Coupled&) = delete;
+		Coupled(Coupled&&) = delete;
+		Coupled &operator=(const Coupled&) = delete;
+		Coupled &operator=(Coupled&&) = delete;
+
+		//Queue a message for the other core; has to be called from the sender's thread
+		//Fails if the queue is full; queueSize has to cover the traffic of one quantum
+		__forceinline bool send(Core from, const Message &m) {
+			return queues[from].push(m);
+		}
+
+		//Memory both cores see; guest stores to [base, base + size) are sent to the other core
+		//A size of 0 turns it off. Has to be set while the cores aren't running
+		void share(u32 base, u32 size) {
+			sharedBase = base;
+			sharedSize = size;
+		}
+
+		//Captured stores that didn't fit in the queue of a core (they're lost)
+		__forceinline usz dropped(Core core) const { return lost[core]; }
+
+		//Instrumentation policy that sends the stores of the running core to the shared range
+		struct SharedWrites : NoHooks {
+
+			struct Channel {
+				Queue *queue;
+				u32 base, size;
+				usz *lost;
+			};
+
+			static inline thread_local Channel current{};
+
+			static __forceinline void onWrite(u32 address, u32 size, u32 value) {
+
+				if (address - current.base >= current.size)
+					return;
+
+				const typename Message::Type type =
+					size == 1 ? Message::WRITE8 : size == 2 ? Message::WRITE16 : Message::WRITE32;
+
+				if (!current.queue->push({ type, address, value }))
+					++*current.lost;
+			}
+
+		};
+
+		//Run both cores on the calling thread (main first); deterministic, meant for debugging
+		void runInterleaved(usz mainCycles);
+
+		//Run the sub core on its own thread and the main core on the calling thread
+		//Gives the same result as runInterleaved, since messages are only exchanged at quantum boundaries
+		void runThreaded(usz mainCycles);
+
+		FifoCallback onFifo{};
+		void *user{};
+
+	private:
+
+		Armulator *cores[2];
+		Queue queues[2];		//Messages sent by the core
+
+		usz quantum;
+		u32 mainClock, subClock;
+
+		u32 sharedBase{}, sharedSize{};
+		usz lost[2]{};
+
+		std::atomic<u32> arrived{}, generation{};
+
+		//Cycle target of a core after t main cycles of this run
+		__forceinline usz target(Core core, usz start, usz t) const {
+			return start + (core == MAIN ? t : usz(u64(t) * subClock / mainClock));
+		}
+
+		template<Core core>
+		__forceinline void runCore(usz until) {
+
+			constexpr Armulator::Version v = core == MAIN ? mainV : subV;
+
+			if (!sharedSize) {
+				cores[core]->template run<v>(until);
+				return;
+			}
+
+			SharedWrites::current = { &queues[core], sharedBase, sharedSize, &lost[core] };
+			cores[core]->template run<v, Armulator::NONE, Armulator::CycleModel::EXACT, SharedWrites>(until);
+			SharedWrites::current = {};
+		}
+
+		//Apply everything the other core sent
+		void receive(Core core);
+
+		//Wait until both threads arrived
+		void barrier();
+
+		template<Core core>
+		void runQuanta(usz start, usz mainCycles);
+	};
+
+	template<Armulator::Version mainV, Armulator::Version subV, usz queueSize>
+	void Coupled<mainV, subV, queueSize>::receive(Core core) {
+
+		Armulator &arm = *cores[core];
+		Queue &queue = queues[core ^ 1];
+		Message m;
+
+		while (queue.pop(m))
+			switch (m.type) {
+
+				case Message::WRITE8:
+					arm.memory.set(m.address, u8(m.value));
+					break;
+
+				case Message::WRITE16:
+					arm.memory.set(m.address, u16(m.value));
+					break;
+
+				case Message::WRITE32:
+					arm.memory.set(m.address, m.value);
+					break;
+
+				case Message::FIFO:
+
+					if (onFifo)
+						onFifo(arm, core, m.value, user);
+
+					break;
+			}
+	}
+
+	template<Armulator::Version mainV, Armulator::Version subV, usz queueSize>
+	void Coupled<mainV, subV, queueSize>::barrier() {
+
+		const u32 gen = generation.load(std::memory_order_acquire);
+
+		if (arrived.fetch_add(1, std::memory_order_acq_rel) == 1) {
+			arrived.store(0, std::memory_order_relaxed);
+			generation.fetch_add(1, std::memory_order_release);
+			return;
+		}
+
+		while (generation.load(std::memory_order_acquire) == gen)
+			std::this_thread::yield();
+	}
+
+	template<Armulator::Version mainV, Armulator::Version subV, usz queueSize>
+	void Coupled<mainV, subV, queueSize>::runInterleaved(usz mainCycles) {
+
+		const usz start[2] = { cores[MAIN]->cycles, cores[SUB]->cycles };
+
+		for (usz t = 0; t < mainCycles; ) {
+
+			t = t + quantum < mainCycles ? t + quantum : mainCycles;
+
+			runCore<MAIN>(target(MAIN, start[MAIN], t));
+			runCore<SUB>(target(SUB, start[SUB], t));
+
+			receive(MAIN);
+			receive(SUB);
+		}
+	}
+
+	//Both threads have to run the same number of quanta, otherwise the barrier never releases
+
+	template<Armulator::Version mainV, Armulator::Version subV, usz queueSize>
+	template<typename Coupled<mainV, subV, queueSize>::Core core>
+	void Coupled<mainV, subV, queueSize>::runQuanta(usz start, usz mainCycles) {
+
+		for (usz t = 0; t < mainCycles; ) {
+
+			t = t + quantum < mainCycles ? t + quantum : mainCycles;
+
+			runCore<core>(target(core, start, t));
+
+			barrier();			//Everything from this quantum is queued
+			receive(core);
+			barrier();			//Nobody starts sending the next quantum's messages before both received
+		}
+	}
+
+	template<Armulator::Version mainV, Armulator::Version subV, usz queueSize>
+	void Coupled<mainV, subV, queueSize>::runThreaded(usz mainCycles) {
+
+		const usz subStart = cores[SUB]->cycles;
+
+		std::thread sub([this, subStart, mainCycles]() { runQuanta<SUB>(subStart, mainCycles); });
+
+		runQuanta<MAIN>(cores[MAIN]->cycles, mainCycles);
+		sub.join();
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,356 @@
+#pragma once
+#include "registers.hpp"
+#include "instrumentation.hpp"
+
+namespace arm {
+
+	//CP15 of the ARM946E-S; protection unit (MPU) and tightly coupled memory (TCM) configuration
+	//The 8 regions (c6) with their access permissions (c5) are compiled into a bitmap per kind of access whenever they change:
+	//a bit per 4 KiB page (the smallest region), so an access is checked with one bit lookup instead of walking the regions.
+	//Higher regions take priority; addresses outside of all regions can't be accessed.
+	//The TCM windows (c9) are only kept here; the memory behind them is mapped by the host (see itcm/dtcm).
+	//Caches aren't emulated; their configuration is stored and cache operations (c7) are accepted.
+
+	struct Cp15 {
+
+		enum Access : u8 {
+			READ, WRITE, EXECUTE,
+			USER,							//Add to the above for user mode accesses
+			COUNT = USER * 2
+		};
+
+		//Control register (c1)
+
+		static constexpr u32
+			PROTECT = 1 << 0, DCACHE = 1 << 2, BIG = 1 << 7, ICACHE = 1 << 12, HIGH_VECTORS = 1 << 13,
+			DTCM = 1 << 16, DTCM_LOAD = 1 << 17, ITCM = 1 << 18, ITCM_LOAD = 1 << 19,
+			controlMask = 0x000FF085, controlOnes = 0x78;
+
+		static constexpr u32 id = 0x41059461, cacheType = 0x0F0D2112, tcmSize = 0x00140180;
+
+		struct Window {
+			u32 base, size;
+			bool enabled;
+		};
+
+		u32 control = controlOnes;
+		u32 region[8]{};			//c6; bit 0 enables, bit 1-5 is the size (2 << n bytes), bit 12-31 the base
+		u32 dataAp{}, codeAp{};		//c5; extended permissions, a nibble per region
+		u32 dcacheable{}, icacheable{}, bufferable{};
+		u32 dtcmRegion{}, itcmRegion{};
+		u32 lockdown[2]{};
+
+		__forceinline bool enabled() const { return control & PROTECT; }
+
+		//If the access to the address is allowed; the protection unit has to have been enabled before
+		__forceinline bool allows(u32 access, u32 address) const {
+			const u32 page = address >> 12;
+			return (pages[access][page >> 6] >> (page & 63)) & 1;
+		}
+
+		//TCM windows; ITCM is always at 0 (the base is ignored)
+		__forceinline Window dtcm() const { return { dtcmRegion & ~0xFFFu, 0x200u << ((dtcmRegion >> 1) & 0x1F), bool(control & DTCM) }; }
+		__forceinline Window itcm() const { return { 0, 0x200u << ((itcmRegion >> 1) & 0x1F), bool(control & ITCM) }; }
+
+		//MRC/MCR p15, opc1, Rd, CRn, CRm, opc2; false if the register doesn't exist
+		bool read(u32 crn, u32 opc1, u32 crm, u32 opc2, u32 &value) const;
+		bool write(u32 crn, u32 opc1, u32 crm, u32 opc2, u32 value);
+
+		//MRC/MCR in ir; only privileged modes can access CP15
+		bool transfer(Registers &r, const u8 *m);
+
+		//Rebuild the bitmaps; needed after changing the registers directly instead of through write
+		//While disabled every access is allowed, so a block that still checks doesn't fault
+		void compile();
+
+	private:
+
+		static constexpr usz words = (usz(1) << 20) / 64;
+
+		List<u64> pages[COUNT];
+
+		//Permissions of an extended AP nibble: bit 0 read, 1 write, 2 user read, 3 user write
+		static constexpr u8 rights[16] = { 0, 0x3, 0x7, 0xF, 0, 0x1, 0x5, 0 };
+
+		static void fill(List<u64> &bits, u32 first, u32 end, bool allowed);
+
+	};
+
+	//Memory under the protection unit; a denied data access reads 0 or is dropped, and is reported through fault
+	//The run loop puts the registers back and raises the abort (see protectedStep)
+
+	template<typename Memory>
+	struct Protected {
+
+		Memory &memory;
+		const Cp15 &cp15;
+		u32 user;				//Cp15::USER in user mode
+		bool fault{};
+
+		template<typename T>
+		__forceinline T get(u32 address) {
+
+			if (!cp15.allows(Cp15::READ + user, address)) {
+				fault = true;
+				return T{};
+			}
+
+			return memory.template get<T>(address);
+		}
+
+		template<typename T>
+		__forceinline void set(u32 address, T t) {
+
+			if (!cp15.allows(Cp15::WRITE + user, address)) {
+				fault = true;
+				return;
+			}
+
+			memory.set(address, t);
+		}
+
+	};
+
+	template<typename Memory>
+	static constexpr bool isProtected = false;
+
+	template<typename Memory>
+	static constexpr bool isProtected<Protected<Memory>> = true;
+
+	//Instruction fetches aren't data accesses; they're checked as the instruction executes
+
+	template<typename Memory>
+	__forceinline auto &unprobed(Protected<Memory> &memory) {
+		return unprobed(memory.memory);
+	}
+
+	inline void Cp15::fill(List<u64> &bits, u32 first, u32 end, bool allowed) {
+
+		const u64 value = allowed ? ~0ull : 0;
+
+		for (; first < end && (first & 63); ++first)
+			bits[first >> 6] = (bits[first >> 6] & ~(1ull << (first & 63))) | ((value & 1) << (first & 63));
+
+		for (; first + 64 <= end; first += 64)
+			bits[first >> 6] = value;
+
+		for (; first < end; ++first)
+			bits[first >> 6] = (bits[first >> 6] & ~(1ull << (first & 63))) | ((value & 1) << (first & 63));
+	}
+
+	inline void Cp15::compile() {
+
+		for (List<u64> &bits : pages)
+			bits.assign(words, enabled() ? 0 : ~0ull);
+
+		if (!enabled())
+			return;
+
+		for (u32 i = 0; i < 8; ++i) {
+
+			const u32 reg = region[i];
+
+			if (!(reg & 1))
+				continue;
+
+			//Regions are at least 4 KiB and aligned to their size
+
+			const u32 shift = ((reg >> 1) & 0x1F) + 1;
+
+			if (shift < 12)
+				continue;
+
+			const u32 pageCount = u32(1) << (shift - 12);
+			const u32 first = (reg >> 12) & ~(pageCount - 1);
+
+			const u8 data = rights[(dataAp >> (i * 4)) & 0xF], code = rights[(codeAp >> (i * 4)) & 0xF];
+
+			fill(pages[READ], first, first + pageCount, data & 1);
+			fill(pages[WRITE], first, first + pageCount, data & 2);
+			fill(pages[EXECUTE], first, first + pageCount, code & 1);
+			fill(pages[USER + READ], first, first + pageCount, data & 4);
+			fill(pages[USER + WRITE], first, first + pageCount, data & 8);
+			fill(pages[USER + EXECUTE], first, first + pageCount, code & 4);
+		}
+	}
+
+	inline bool Cp15::read(u32 crn, u32 opc1, u32 crm, u32 opc2, u32 &value) const {
+
+		if (opc1)
+			return false;
+
+		//The 2-bit permissions are the low bits of the extended ones
+
+		auto simple = [](u32 ap) {
+
+			u32 result{};
+
+			for (u32 i = 0; i < 8; ++i)
+				result |= ((ap >> (i * 4)) & 3) << (i * 2);
+
+			return result;
+		};
+
+		switch (crn) {
+
+			case 0:
+				value = opc2 == 1 ? cacheType : opc2 == 2 ? tcmSize : id;
+				return crm == 0;
+
+			case 1:
+				value = control;
+				return crm == 0 && opc2 == 0;
+
+			case 2:
+				value = opc2 ? icacheable : dcacheable;
+				return crm == 0 && opc2 < 2;
+
+			case 3:
+				value = bufferable;
+				return crm == 0 && opc2 == 0;
+
+			case 5:
+				value = opc2 == 0 ? simple(dataAp) : opc2 == 1 ? simple(codeAp) : opc2 == 2 ? dataAp : codeAp;
+				return crm == 0 && opc2 < 4;
+
+			case 6:
+				value = region[crm & 7];
+				return crm < 8 && opc2 == 0;
+
+			case 9:
+
+				if (crm == 0) {
+					value = lockdown[opc2 & 1];
+					return opc2 < 2;
+				}
+
+				value = opc2 ? itcmRegion : dtcmRegion;
+				return crm == 1 && opc2 < 2;
+
+			default:
+				return false;
+		}
+	}
+
+	inline bool Cp15::write(u32 crn, u32 opc1, u32 crm, u32 opc2, u32 value) {
+
+		if (opc1)
+			return false;
+
+		//Setting the 2-bit permissions clears the upper bits of the extended ones
+
+		auto extend = [](u32 ap) {
+
+			u32 result{};
+
+			for (u32 i = 0; i < 8; ++i)
+				result |= ((ap >> (i * 2)) & 3) << (i * 4);
+
+			return result;
+		};
+
+		switch (crn) {
+
+			case 1: {
+
+				if (crm || opc2)
+					return false;
+
+				const bool wasEnabled = enabled();
+				control = (value & controlMask) | controlOnes;
+
+				if (wasEnabled != enabled())
+					compile();
+
+				return true;
+			}
+
+			case 2:
+
+				if (crm || opc2 > 1)
+					return false;
+
+				(opc2 ? icacheable : dcacheable) = value & 0xFF;
+				return true;
+
+			case 3:
+
+				if (crm || opc2)
+					return false;
+
+				bufferable = value & 0xFF;
+				return true;
+
+			case 5:
+
+				if (crm || opc2 > 3)
+					return false;
+
+				(opc2 & 1 ? codeAp : dataAp) = opc2 < 2 ? extend(value & 0xFFFF) : value;
+				break;
+
+			case 6:
+
+				if (crm > 7 || opc2)
+					return false;
+
+				region[crm] = value & 0xFFFFF03F;
+				break;
+
+			//Cache operations, wait for interrupt and drain write buffer
+
+			case 7:
+				return true;
+
+			case 9:
+
+				if (crm == 0 && opc2 < 2) {
+					lockdown[opc2] = value;
+					return true;
+				}
+
+				if (crm != 1 || opc2 > 1)
+					return false;
+
+				(opc2 ? itcmRegion : dtcmRegion) = value & 0xFFFFF03E;
+				return true;
+
+			default:
+				return false;
+		}
+
+		if (enabled())
+			compile();
+
+		return true;
+	}
+
+	inline bool Cp15::transfer(Registers &r, const u8 *m) {
+
+		const u32 ir = r.ir;
+
+		if (r.cpsr.mode() == Mode::USR || (ir & 0x0F000F10) != 0x0E000F10)
+			return false;
+
+		const u32 crn = (ir >> 16) & 0xF, opc1 = (ir >> 21) & 7, crm = ir & 0xF, opc2 = (ir >> 5) & 7;
+		u32 &reg = r.registers[m[(ir >> 12) & 0xF]];
+
+		if (!(ir & 0x100000))
+			return write(crn, opc1, crm, opc2, reg);
+
+		u32 value;
+
+		if (!read(crn, opc1, crm, opc2, value))
+			return false;
+
+		//MRC to r15 sets the flags
+
+		if (((ir >> 12) & 0xF) == Register::pc)
+			r.cpsr.value = (r.cpsr.value & 0x0FFFFFFF) | (value & 0xF0000000);
+		else
+			reg = value;
+
+		return true;
+	}
+
+}
\ No newline at end of file
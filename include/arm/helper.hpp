@@ -1,14 +1,97 @@
 #pragma once
 #include "emu/helper.hpp"
 #include "registers.hpp"
+#include "instrumentation.hpp"
+#include <type_traits>
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
 
 namespace arm {
 
+	//Bit operations
+
+	//Index of the lowest set bit; v can't be 0
+	_inline_ u32 ctz(u32 v) {
+		#ifdef _MSC_VER
+			unsigned long i;
+			_BitScanForward(&i, v);
+			return u32(i);
+		#else
+			return u32(__builtin_ctz(v));
+		#endif
+	}
+
+	//Number of leading zero bits; 32 if v is 0
+	//The 64-bit scan of v with ones below it can't be 0, so 0 needs no branch
+	_inline_ u32 clz(u32 v) {
+		#ifdef _MSC_VER
+			unsigned long i;
+			_BitScanReverse64(&i, (u64(v) << 32) | 0xFFFFFFFF);
+			return u32(63 - i);
+		#else
+			return u32(__builtin_clzll((u64(v) << 32) | 0xFFFFFFFF));
+		#endif
+	}
+
+	//Number of set bits
+	_inline_ u32 popcount(u32 v) {
+		#ifdef _MSC_VER
+			return u32(__popcnt(v));
+		#else
+			return u32(__builtin_popcount(v));
+		#endif
+	}
+
+	//Arithmetic with carry in; the carry out is from the full 33-bit result, so b + C can't wrap
+
+	//ADC; a += b + C
+	_inline_ void adcTo(PSR &psr, u32 &a, u32 b) {
+
+		const u64 res = u64(a) + b + psr.carry();
+		const u32 res32 = u32(res);
+
+		psr.overflow((~(a ^ b) & (a ^ res32)) >> 31);
+		psr.carry(res >> 32);
+		psr.setCodes(res32);
+		a = res32;
+	}
+
+	//SBC; a -= b + !C (carry is not borrow)
+	_inline_ void sbcFrom(PSR &psr, u32 &a, u32 b) {
+
+		const u32 borrow = !psr.carry(), res = a - b - borrow;
+
+		psr.overflow(((a ^ b) & (a ^ res)) >> 31);
+		psr.carry(u64(a) >= u64(b) + borrow);
+		psr.setCodes(res);
+		a = res;
+	}
+
+	//Internal cycles of an ARM7 multiply by rs (1-4); the multiplier stops early once the remaining bytes are all 0 or all 1
+	_inline_ u32 multiplyCycles(u32 rs) {
+		const u32 a = rs ^ u32(i32(rs) >> 31);
+		return 1 + (a >= 1 << 8) + (a >= 1 << 16) + (a >= 1 << 24);
+	}
+
+	//Cycle counter for the interpreter that drops instruction timings (memory accesses, multiplies, refills)
+	//Used by Armulator::CycleModel::APPROXIMATE and NONE; every operation compiles away
+
+	struct NoCycles {
+		__forceinline NoCycles &operator++() { return *this; }
+		__forceinline NoCycles &operator+=(usz) { return *this; }
+	};
+
+	//If the counter keeps instruction timings; used to skip work that only estimates cycles
+	template<typename Cycles>
+	static constexpr bool countsCycles = !std::is_same_v<Cycles, NoCycles>;
+
 	//Incrementing multiple data instruction
 	//bool st; whether it stores or loads
-	//miaPos<false> = POP, miaPos<true> = STMIA
-	template<typename AddressType, bool st, usz regs = 8, typename Memory>
-	_inline_ void miaPos(Memory &mem, usz &cycles, AddressType &ptr, Registers &r) {
+	//miaPos<false> = POP/LDMIA, miaPos<true> = STMIA
+	template<typename AddressType, bool st, usz regs = 8, typename Memory, typename Cycles>
+	_inline_ void miaPos(Memory &mem, Cycles &cycles, AddressType &ptr, Registers &r) {
 
 		for (usz i = 0; i < regs; ++i)
 			if (r.ir & (1 << i)) {
@@ -16,27 +99,28 @@ namespace arm {
 				if constexpr (st)
 					mem.set(ptr, r.loReg[i]);
 				else
-					r.loReg[i] = mem.get<AddressType>(ptr);
+					r.loReg[i] = mem.template get<AddressType>(ptr);
 
 				ptr += 4;
 				++cycles;
 			}
 	}
 
-	//Decrementing multiple data instruction
+	//Decrementing multiple data instruction (decrements before the access)
 	//bool st; whether it stores or loads
-	//miaNeg<false> = LDMIA, miaNeg<true> = PUSH
-	template<typename AddressType, bool st, usz regs = 8, typename Memory>
-	_inline_ void miaNeg(Memory &mem, usz &cycles, AddressType &ptr, Registers &r) {
+	//miaNeg<true> = PUSH
+	template<typename AddressType, bool st, usz regs = 8, typename Memory, typename Cycles>
+	_inline_ void miaNeg(Memory &mem, Cycles &cycles, AddressType &ptr, Registers &r) {
 		for (usz i = 0; i < regs; ++i)
 			if (r.ir & (0x80 >> i)) {
 
+				ptr -= 4;
+
 				if constexpr (st)
 					mem.set(ptr, r.loReg[7 - i]);
 				else
-					r.loReg[7 - i] = mem.get<AddressType>(ptr);
+					r.loReg[7 - i] = mem.template get<AddressType>(ptr);
 
-				ptr -= 4;
 				++cycles;
 			}
 	}
@@ -49,10 +133,10 @@ namespace arm {
 		r.ir = r.nir;
 
 		if constexpr (isThumb) {
-			r.nir = memory.get<u16>(r.pc);
+			r.nir = unprobed(memory).template get<u16>(r.pc);
 			r.pc += 2;
 		} else {
-			r.nir = memory.get<u32>(r.pc);
+			r.nir = unprobed(memory).template get<u32>(r.pc);
 			r.pc += 4;
 		}
 	}
@@ -60,8 +144,8 @@ namespace arm {
 	//Branch which can change the thumb flag or just continue the current mode
 	//Prefetches next instructions
 
-	template<bool thumb, bool exchange, bool forceArm = false, typename Memory>
-	_inline_ void branch(Registers &r, Memory &mem, usz &cycles, const u8 *&mapping) {
+	template<bool thumb, bool exchange, bool forceArm = false, typename Memory, typename Cycles>
+	_inline_ void branch(Registers &r, Memory &mem, Cycles &cycles, const u8 *&mapping) {
 
 		cycles += 2;
 
@@ -98,10 +182,17 @@ namespace arm {
 	}
 
 	//Trigger exception and prefetch
-	template<bool thumb, Exception e, typename Memory>
-	_inline_ void exception(Registers &r, Memory &mem, usz &cycles, const u8 *&mapping) {
-		r.exception<e>();
-		branch<thumb, true, true>(r, mem, cycles, mapping);
+	//The mapping is switched to the banked registers of the exception's mode (ARM state)
+	//Returns false if the exception was disabled (IRQ/FIQ); nothing changes in that case
+	template<bool thumb, Exception e, typename Memory, typename Cycles>
+	_inline_ bool exception(Registers &r, Memory &mem, Cycles &cycles, const u8 *&mapping) {
+
+		if (!r.exception<e>())
+			return false;
+
+		mapping = Registers::mapping[Mode::toId(r.cpsr.mode())];
+		branch<false, false>(r, mem, cycles, mapping);
+		return true;
 	}
 
 	//If the condition should be executed
@@ -0,0 +1,98 @@
+#pragma once
+#include "types/types.hpp"
+#include <algorithm>
+
+namespace arm {
+
+	struct Armulator;
+
+	//Host functions that replace guest routines (memcpy, division helpers, CRC, soft float, ...)
+	//When a block starts at a hooked address, the callback runs instead of the guest code and returns to lr.
+	//Arguments and results use AAPCS (Armulator::argument / Armulator::result).
+	//The run loop tests the pc against a 64-bit filter at every block boundary;
+	//only blocks that pass it search the hook list, so blocks that aren't hooked cost one AND.
+
+	struct HostHooks {
+
+		using Callback = void (*)(Armulator &arm, void *user);
+
+		//Hook a guest function; add 1 to the address if it's a thumb function (like a BX target)
+		//The cycles are added on every call, on top of the branch back to lr
+		void add(u32 address, Callback callback, usz cycles = 0, void *user = nullptr) {
+
+			const Hook h{ key(address), callback, cycles, user };
+
+			auto it = std::lower_bound(hooks.begin(), hooks.end(), h.pc, before);
+
+			if (it != hooks.end() && it->pc == h.pc)
+				*it = h;
+			else
+				hooks.insert(it, h);
+
+			filter |= bit(h.pc);
+		}
+
+		//Returns false if the address wasn't hooked
+		bool remove(u32 address) {
+
+			const u32 pc = key(address);
+			auto it = std::lower_bound(hooks.begin(), hooks.end(), pc, before);
+
+			if (it == hooks.end() || it->pc != pc)
+				return false;
+
+			hooks.erase(it);
+
+			filter = 0;
+
+			for (const Hook &h : hooks)
+				filter |= bit(h.pc);
+
+			return true;
+		}
+
+		//If the block at pc (after prefetch) might be hooked; the filter ignores the thumb bit
+		__forceinline bool maybe(u32 pc) const { return filter & bit(pc); }
+
+	private:
+
+		friend struct Armulator;
+
+		//Keyed on the pc after the pipeline is filled; entry + 4 in thumb and entry + 8 in arm mode.
+		//The pc is always even, so bit 0 holds the thumb bit to keep arm and thumb entries apart
+
+		struct Hook {
+			u32 pc;
+			Callback callback;
+			usz cycles;
+			void *user;
+		};
+
+		static __forceinline u32 key(u32 address) {
+			return address & 1 ? ((address & ~1) + 4) | 1 : (address & ~3) + 8;
+		}
+
+		static __forceinline u64 bit(u32 pc) {
+			return u64(1) << ((pc >> 1) & 63);
+		}
+
+		static __forceinline bool before(const Hook &h, u32 pc) {
+			return h.pc < pc;
+		}
+
+		const Hook *find(u32 pc) const {
+
+			auto it = std::lower_bound(hooks.begin(), hooks.end(), pc, before);
+
+			if (it == hooks.end() || it->pc != pc)
+				return nullptr;
+
+			return &*it;
+		}
+
+		u64 filter{};
+		List<Hook> hooks;
+
+	};
+
+}
\ No newline at end of file
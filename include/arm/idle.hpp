@@ -0,0 +1,217 @@
+#pragma once
+#include "registers.hpp"
+#include "thumb/opcodes.hpp"
+#include "thumb/values.hpp"
+
+namespace arm {
+
+	//Detects guest loops that can't make progress on their own; "B ." or polling loops such as LDR/CMP/BNE
+	//A loop is idle if:
+	//	- it's a single thumb block that branches back to its own start
+	//	- it has no side effects; loads are fine, stores/stack/SWI aren't
+	//	- the registers and flags at the start of two consecutive iterations are identical
+	//Every next iteration would then do exactly the same, until memory changes or an interrupt arrives.
+	//Both only happen through events, interrupts or the other core; so the run loop can skip to the next of those.
+	//It doesn't skip while an interrupt is deliverable, since that ends the loop at the next boundary.
+	//Only checked at block boundaries; a block that isn't a self loop costs one compare.
+
+	struct IdleDetector {
+
+		bool enabled = false;
+
+		//Called at a block boundary; if the current block is an idle loop,
+		//the cycle counter is moved forward by whole iterations, as close to until as possible
+		template<typename Memory>
+		void skip(const Registers &r, Memory &mem, usz &cycles, usz until);
+
+	private:
+
+		static constexpr u32 none = ~u32(0);
+
+		u32 last = none;			//Start of the previous block
+		u32 analyzed = none;		//Start of the last analyzed block
+		bool pure = false;			//If the last analyzed block is free of side effects
+		bool armed = false;			//If the snapshot is taken at the start of an iteration
+
+		usz lastCycles{};
+
+		u32 snapshot[Register::count];
+		u32 cpsr{};
+
+		template<typename Memory>
+		static bool isPure(Memory &mem, u32 start);
+
+		void take(const Registers &r);
+		bool same(const Registers &r) const;
+	};
+
+	template<typename Memory>
+	void IdleDetector::skip(const Registers &r, Memory &mem, usz &cycles, usz until) {
+
+		if (!r.cpsr.thumb()) {
+			last = none;
+			return;
+		}
+
+		const u32 start = r.pc - 4;
+
+		if (start != last) {
+			last = start;
+			armed = false;
+			return;
+		}
+
+		//Branched back to itself
+
+		if (analyzed != start) {
+			analyzed = start;
+			pure = isPure(mem, start);
+		}
+
+		if (!pure)
+			return;
+
+		if (armed && same(r)) {
+
+			const usz iteration = cycles - lastCycles;
+
+			if (until > cycles)
+				cycles += (until - cycles) / iteration * iteration;
+
+		} else {
+			take(r);
+			armed = true;
+		}
+
+		lastCycles = cycles;
+	}
+
+	//Go through the whole block until its unconditional terminator; any store in it rules the loop out,
+	//even after a conditional branch back to the start (that branch isn't always taken).
+	//One of the branches has to go back to the start; exits elsewhere just end the loop.
+
+	template<typename Memory>
+	bool IdleDetector::isPure(Memory &mem, u32 start) {
+
+		using namespace thumb;
+
+		//Blocks longer than this are unlikely to be polling loops
+		static constexpr usz maxLength = 32;
+
+		bool loops = false;
+
+		for (u32 pc = start, i = 0; i < maxLength; ++i, pc += 2) {
+
+			struct { u32 ir; } r{ mem.template get<u16>(pc) };
+
+			switch (Op5_11) {
+
+				case STRi:
+				case STRBi:
+				case STRHi:
+				case STR_SP:
+				case STMIA:
+				case BLL:
+				case BLH:
+				case BLX:
+					return false;
+
+				case B:
+					return loops || pc + 4 + s12 == start;
+
+				//ADD SP, #i shares its 5-bit opcode with PUSH; moving sp is caught by the register compare
+
+				case INCR_SP:
+
+					if (Op8_8 == PUSH || Op8_8 == PUSH_LR)
+						return false;
+
+					continue;
+
+				case B0:
+				case B1:
+				case PUSH_POP:
+
+					switch (Op8_8) {
+
+						case BEQ: case BNE: case BCS: case BCC:
+						case BMI: case BPL: case BVS: case BVC:
+						case BHI: case BLS: case BGE: case BLT:
+						case BGT: case BLE:
+							loops |= pc + 4 + (u32(i8(i8_0)) << 1) == start;
+							continue;
+
+						case BAL:
+							return loops || pc + 4 + (u32(i8(i8_0)) << 1) == start;
+
+						case POP:
+							continue;
+
+						default:			//SWI, POP PC, BKPT
+							return false;
+					}
+
+				case ADD_SUB:
+				case ST:
+				case LD:
+
+					if (Op7_9 == STR || Op7_9 == STRH || Op7_9 == STRB)
+						return false;
+
+					continue;
+
+				case ALU_HI_BX:
+
+					switch (Op10_6) {
+
+						case BX_LO:
+						case BX_HI:
+							return false;
+
+						case ADD_HI_LO:
+						case ADD_HI_HI:
+						case MOV_HI_LO:
+						case MOV_HI_HI:
+
+							if ((Rd3_0 | 8) == Register::pc)
+								return false;
+
+							continue;
+
+						default:
+							continue;
+					}
+
+				default:
+					continue;
+			}
+		}
+
+		return false;
+	}
+
+	inline void IdleDetector::take(const Registers &r) {
+
+		const u8 *m = Registers::mapping[Mode::toId(r.cpsr.mode())];
+
+		for (usz i = 0; i < Register::count; ++i)
+			snapshot[i] = r.registers[m[i]];
+
+		cpsr = r.cpsr.value;
+	}
+
+	inline bool IdleDetector::same(const Registers &r) const {
+
+		if (cpsr != r.cpsr.value)
+			return false;
+
+		const u8 *m = Registers::mapping[Mode::toId(r.cpsr.mode())];
+
+		for (usz i = 0; i < Register::count; ++i)
+			if (snapshot[i] != r.registers[m[i]])
+				return false;
+
+		return true;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+#include "registers.hpp"
+#include <type_traits>
+
+namespace arm {
+
+	//Instrumentation policy for the run loop (profilers, tracers, coverage)
+	//A policy is a type with static callbacks; derive from NoHooks and only redefine the ones needed.
+	//	onFetch: before an instruction executes; address of the instruction and its opcode
+	//	onRead/onWrite: data accesses (not instruction fetches); size in bytes, value zero extended
+	//	onBranch: the pipeline was refilled at another address (taken branch, interworking, return)
+	//	onException: an exception was entered (from an instruction or a pending interrupt)
+	//	onBlock: a block finished; its start address (bit 0 set for thumb), the cycles it took and its instructions
+	//The run loop compiles NoHooks to the same code as without instrumentation;
+	//memory is only wrapped in a Probe if a policy is used.
+	//A policy that only needs the block callbacks (onBlock, onBranch, onException) can say so with
+	//fetchHooks = false (no onFetch; pairs stay fused) and accessHooks = false (no onRead/onWrite; memory isn't probed).
+
+	struct NoHooks {
+		static constexpr bool fetchHooks = true, accessHooks = true;
+		static __forceinline void onFetch(const Registers&, u32 /* address */, u32 /* ir */) {}
+		static __forceinline void onRead(u32 /* address */, u32 /* size */, u32 /* value */) {}
+		static __forceinline void onWrite(u32 /* address */, u32 /* size */, u32 /* value */) {}
+		static __forceinline void onBranch(const Registers&, u32 /* from */, u32 /* to */) {}
+		static __forceinline void onException(const Registers&, Exception) {}
+		static __forceinline void onBlock(const Registers&, u32 /* start */, usz /* cycles */, usz /* instructions */) {}
+	};
+
+	template<typename Hooks>
+	static constexpr bool hasHooks = !std::is_same_v<Hooks, NoHooks>;
+
+	template<typename Hooks>
+	static constexpr bool hooksFetches = hasHooks<Hooks> && Hooks::fetchHooks;
+
+	template<typename Hooks>
+	static constexpr bool hooksAccesses = hasHooks<Hooks> && Hooks::accessHooks;
+
+	//Memory that reports data accesses to the policy
+
+	template<typename Hooks, typename Memory>
+	struct Probe {
+
+		Memory &memory;
+
+		template<typename T>
+		__forceinline T get(u32 address) {
+			const T t = memory.template get<T>(address);
+			Hooks::onRead(address, u32(sizeof(T)), u32(std::make_unsigned_t<T>(t)));
+			return t;
+		}
+
+		template<typename T>
+		__forceinline void set(u32 address, T t) {
+			Hooks::onWrite(address, u32(sizeof(T)), u32(std::make_unsigned_t<T>(t)));
+			memory.set(address, t);
+		}
+
+	};
+
+	//Instruction fetches bypass the probe
+
+	template<typename Memory>
+	__forceinline Memory &unprobed(Memory &memory) {
+		return memory;
+	}
+
+	template<typename Hooks, typename Memory>
+	__forceinline Memory &unprobed(Probe<Hooks, Memory> &probe) {
+		return probe.memory;
+	}
+
+	//Exception that enters at a vector; an exception refills the pipeline at it in ARM state
+
+	_inline_ bool vectorException(u32 address, Exception &e) {
+
+		static constexpr Exception vectors[] = {
+			Exception::RESET, Exception::UND, Exception::SWI, Exception::PREFETCH_ABORT,
+			Exception::DATA_ABORT, Exception::RESET, Exception::IRQ, Exception::FIQ
+		};
+
+		if (address >= 0x20 || (address & 3) || address == 0x14)
+			return false;
+
+		e = vectors[address >> 2];
+		return true;
+	}
+
+	//Called at the end of a block; from is the address of the instruction that refilled the pipeline
+
+	template<typename Hooks>
+	_inline_ void reportRefill(const Registers &r, u32 from) {
+
+		const u32 to = r.pc - (r.cpsr.thumb() ? 4 : 8);
+		Exception e;
+
+		if (!r.cpsr.thumb() && vectorException(to, e))
+			Hooks::onException(r, e);
+		else
+			Hooks::onBranch(r, from, to);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,348 @@
+#pragma once
+#include "helper.hpp"
+#include <atomic>
+#include <cstdio>
+#include <string>
+
+namespace arm {
+
+	//Guest performance counters
+	//The run loop counts through the Counting policy into the thread's attached counters.
+	//Counts are kept in plain fields by the emulation thread, per block, and published to atomics every
+	//publishInterval blocks, so any thread can read a recent snapshot without stopping the CPU.
+	//
+	//Cycles are split by their source: 1 per instruction, 2 per pipeline refill and the rest
+	//(memory waits and internal cycles of multiplies, LDM/STM, ...); the interpreter doesn't model N/S/I cycles.
+
+	struct PerfCounters {
+
+		static constexpr usz regions = 16;		//Memory regions; bits 24-27 of the address
+		static constexpr usz exceptions = 8;	//Exception vector / 4
+
+		static constexpr u32 publishInterval = 64;		//Blocks; a power of two
+
+		struct Snapshot {
+
+			u64 thumbInstructions, armInstructions;
+
+			u64 cycles;
+			u64 instructionCycles, refillCycles, otherCycles;
+
+			u64 taken, notTaken;				//Branches; taken includes every refill that isn't an exception
+			u64 refills;
+
+			u64 exceptions[PerfCounters::exceptions];
+			u64 loads[PerfCounters::regions], stores[PerfCounters::regions];
+		};
+
+		//Count the calling thread's blocks into these counters (until detach)
+		__forceinline void attach() { current = this; }
+		static __forceinline void detach() { current = nullptr; }
+
+		static inline thread_local PerfCounters *current{};
+
+		//Consistent per counter, not across counters; can be called from any thread
+		Snapshot snapshot() const;
+
+		//Publish what's counted so far; call on the emulation thread (e.g. when a run returns)
+		void publish();
+
+		//Prometheus text exposition format; instance is added as a label if set
+		void prometheus(std::FILE *out, const c8 *instance = nullptr) const;
+
+		//Write the exposition to a file atomically (written next to it, then renamed), for a textfile collector
+		bool writePrometheus(const c8 *path, const c8 *instance = nullptr) const;
+
+		//Counted by the policy on the emulation thread
+		//Refills are the taken branches and the exceptions entered
+		//Every block ends in a refill, so the taken branches are the blocks that didn't end at a vector
+
+		__forceinline void block(bool thumb, usz cycles, usz instructions, bool vectored) {
+
+			pending.instructions[thumb] += instructions;
+			pending.cycles += cycles;
+			pending.vectored += vectored;
+
+			if (!(++pending.blocks & (publishInterval - 1)))
+				publish();
+		}
+
+		__forceinline void fetch(bool conditionalBranch) {
+			pending.conditional += conditionalBranch;
+			lastConditional = conditionalBranch;
+		}
+
+		__forceinline void access(u32 address, bool store) {
+			++pending.accesses[store][(address >> 24) & (regions - 1)];
+			touched |= 1u << (((address >> 24) & (regions - 1)) + store * regions);
+		}
+
+		__forceinline void branch() {
+			pending.conditionalTaken += lastConditional;
+		}
+
+		__forceinline void exception(u32 vector) {
+			++pending.exceptions[(vector >> 2) & (exceptions - 1)];
+			++pending.entered;
+			exceptionsPending = true;
+		}
+
+	private:
+
+		using Counter = std::atomic<u64>;
+
+		struct Published {
+
+			Counter instructions[2]{};
+			Counter cycles{}, instructionCycles{}, refillCycles{};
+			Counter taken{}, notTaken{}, refills{};
+
+			Counter exceptions[PerfCounters::exceptions]{};
+			Counter accesses[2][PerfCounters::regions]{};
+		};
+
+		struct Pending {
+
+			u64 instructions[2];
+			u64 cycles, conditional, conditionalTaken, blocks, vectored, entered;
+
+			u64 exceptions[PerfCounters::exceptions];
+			u64 accesses[2][PerfCounters::regions];
+		};
+
+		alignas(64) Published published;
+
+		//Written by the emulation thread only
+
+		alignas(64) Pending pending{};
+		u32 touched{};				//Regions with pending accesses (loads, then stores)
+		bool exceptionsPending{}, lastConditional{};
+
+		//Only one thread writes, so there's no need for read-modify-write atomics
+
+		static __forceinline void add(Counter &c, u64 v) {
+			c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		}
+
+	};
+
+	//Instrumentation policy that counts into PerfCounters::current
+	//Instructions, cycles, refills and exceptions are counted per block, without per instruction callbacks;
+	//pairs stay fused and memory isn't probed, so the only cost is a few adds per block.
+	//branches: decode every instruction to count not-taken branches (taken ones are counted regardless)
+	//onBranch is only used for that; taken branches are derived from the blocks
+	//memory: count data accesses per region
+	//Both need the per instruction path of the run loop, which is a lot slower (10-30%).
+
+	template<bool branches = false, bool memory = false>
+	struct Counting : NoHooks {
+
+		static constexpr bool fetchHooks = branches, accessHooks = memory;
+
+		static __forceinline bool conditionalBranch(u32 ir, bool thumb) {
+
+			if (thumb)
+				return (ir & 0xF000) == 0xD000 && ((ir >> 8) & 0xF) < 0xE;
+
+			return (ir & 0x0E000000) == 0x0A000000 && (ir >> 28) < 0xE;
+		}
+
+		static __forceinline void onFetch(const Registers &r, u32, u32 ir) {
+			if constexpr (branches)
+				if (PerfCounters *c = PerfCounters::current)
+					c->fetch(conditionalBranch(ir, r.cpsr.thumb()));
+		}
+
+		static __forceinline void onRead(u32 address, u32, u32) {
+			if constexpr (memory)
+				if (PerfCounters *c = PerfCounters::current)
+					c->access(address, false);
+		}
+
+		static __forceinline void onWrite(u32 address, u32, u32) {
+			if constexpr (memory)
+				if (PerfCounters *c = PerfCounters::current)
+					c->access(address, true);
+		}
+
+		//Same test as reportRefill; exceptions entered outside of blocks don't end one
+
+		static __forceinline void onBlock(const Registers &r, u32 start, usz cycles, usz instructions) {
+			if (PerfCounters *c = PerfCounters::current) {
+				Exception e;
+				c->block(start & 1, cycles, instructions, !r.cpsr.thumb() && vectorException(r.pc - 8, e));
+			}
+		}
+
+		static __forceinline void onBranch(const Registers&, u32, u32) {
+			if constexpr (branches)
+				if (PerfCounters *c = PerfCounters::current)
+					c->branch();
+		}
+
+		static __forceinline void onException(const Registers&, Exception e) {
+			if (PerfCounters *c = PerfCounters::current)
+				c->exception(u32(e) & 0xFF);
+		}
+
+	};
+
+	inline void PerfCounters::publish() {
+
+		Pending &p = pending;
+		Published &o = published;
+
+		const u64 instructions = p.instructions[0] + p.instructions[1];
+		const u64 taken = p.blocks - p.vectored;
+
+		add(o.instructions[0], p.instructions[0]);
+		add(o.instructions[1], p.instructions[1]);
+		add(o.cycles, p.cycles);
+		add(o.instructionCycles, instructions);
+		add(o.refillCycles, (taken + p.entered) * 2);
+		add(o.taken, taken);
+		add(o.notTaken, p.conditional - p.conditionalTaken);
+		add(o.refills, taken + p.entered);
+
+		p.instructions[0] = p.instructions[1] = 0;
+		p.cycles = p.conditional = p.conditionalTaken = p.blocks = p.vectored = p.entered = 0;
+
+		//Exceptions are rare and only a few regions are used
+
+		if (exceptionsPending)
+			for (usz i = 0; i < exceptions; ++i) {
+				add(o.exceptions[i], p.exceptions[i]);
+				p.exceptions[i] = 0;
+			}
+
+		exceptionsPending = false;
+
+		for (u32 t = touched; t; t &= t - 1) {
+
+			const u32 i = ctz(t), store = i / regions, region = i % regions;
+
+			add(o.accesses[store][region], p.accesses[store][region]);
+			p.accesses[store][region] = 0;
+		}
+
+		touched = 0;
+	}
+
+	inline PerfCounters::Snapshot PerfCounters::snapshot() const {
+
+		const Published &o = published;
+		Snapshot s{};
+
+		auto get = [](const Counter &c) { return c.load(std::memory_order_relaxed); };
+
+		s.thumbInstructions = get(o.instructions[1]);
+		s.armInstructions = get(o.instructions[0]);
+
+		s.cycles = get(o.cycles);
+		s.instructionCycles = get(o.instructionCycles);
+		s.refillCycles = get(o.refillCycles);
+
+		const u64 known = s.instructionCycles + s.refillCycles;
+		s.otherCycles = s.cycles > known ? s.cycles - known : 0;
+
+		s.taken = get(o.taken);
+		s.notTaken = get(o.notTaken);
+		s.refills = get(o.refills);
+
+		for (usz i = 0; i < exceptions; ++i)
+			s.exceptions[i] = get(o.exceptions[i]);
+
+		for (usz i = 0; i < regions; ++i) {
+			s.loads[i] = get(o.accesses[0][i]);
+			s.stores[i] = get(o.accesses[1][i]);
+		}
+
+		return s;
+	}
+
+	inline void PerfCounters::prometheus(std::FILE *out, const c8 *instance) const {
+
+		static constexpr const c8 *exceptionNames[] = {
+			"reset", "undefined", "swi", "prefetch_abort", "data_abort", "reserved", "irq", "fiq"
+		};
+
+		const Snapshot s = snapshot();
+
+		auto header = [out](const c8 *name, const c8 *help) {
+			std::fprintf(out, "# HELP armulator_%s %s\n# TYPE armulator_%s counter\n", name, help, name);
+		};
+
+		auto value = [out, instance](const c8 *name, const c8 *labels, u64 v) {
+
+			std::fprintf(out, "armulator_%s", name);
+
+			if (instance)
+				std::fprintf(out, "{instance=\"%s\"%s%s}", instance, *labels ? "," : "", labels);
+
+			else if (*labels)
+				std::fprintf(out, "{%s}", labels);
+
+			std::fprintf(out, " %llu\n", (unsigned long long) v);
+		};
+
+		header("instructions_total", "Instructions retired");
+		value("instructions_total", "state=\"thumb\"", s.thumbInstructions);
+		value("instructions_total", "state=\"arm\"", s.armInstructions);
+
+		header("cycles_total", "Cycles by source");
+		value("cycles_total", "source=\"instruction\"", s.instructionCycles);
+		value("cycles_total", "source=\"refill\"", s.refillCycles);
+		value("cycles_total", "source=\"other\"", s.otherCycles);
+
+		header("branches_total", "Branches by outcome");
+		value("branches_total", "outcome=\"taken\"", s.taken);
+		value("branches_total", "outcome=\"not_taken\"", s.notTaken);
+
+		header("refills_total", "Pipeline refills");
+		value("refills_total", "", s.refills);
+
+		header("exceptions_total", "Exceptions entered");
+
+		for (usz i = 0; i < exceptions; ++i)
+			if (i != 5) {
+				c8 label[48];
+				std::snprintf(label, sizeof(label), "type=\"%s\"", exceptionNames[i]);
+				value("exceptions_total", label, s.exceptions[i]);
+			}
+
+		header("memory_accesses_total", "Data accesses by region (address bits 24-27)");
+
+		for (usz i = 0; i < regions; ++i) {
+
+			if (!s.loads[i] && !s.stores[i])
+				continue;
+
+			c8 label[48];
+
+			std::snprintf(label, sizeof(label), "region=\"0x%02zX\",op=\"load\"", i);
+			value("memory_accesses_total", label, s.loads[i]);
+
+			std::snprintf(label, sizeof(label), "region=\"0x%02zX\",op=\"store\"", i);
+			value("memory_accesses_total", label, s.stores[i]);
+		}
+	}
+
+	inline bool PerfCounters::writePrometheus(const c8 *path, const c8 *instance) const {
+
+		const std::string temp = std::string(path) + ".tmp";
+		std::FILE *f = std::fopen(temp.c_str(), "w");
+
+		if (!f)
+			return false;
+
+		prometheus(f, instance);
+
+		if (std::fclose(f)) {
+			std::remove(temp.c_str());
+			return false;
+		}
+
+		return !std::rename(temp.c_str(), path);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,182 @@
+#pragma once
+#include "instrumentation.hpp"
+#include "symbols.hpp"
+#include <cstdio>
+
+namespace arm {
+
+	//Execution count and cycles per block start (bit 0 set for thumb)
+	//Kept in an open-addressed hash table with linear probing; a block costs a hash and (usually) one probe.
+	//The run loop fills it through the Profile policy (see instrumentation.hpp) for the thread's attached profiler.
+
+	struct Profiler {
+
+		struct Entry {
+			u32 address;		//Block start; bit 0 set for thumb
+			u64 count;			//Times the block executed (or samples)
+			u64 weight;			//Cycles spent in the block (or samples)
+		};
+
+		//The unit of weight in reports
+		const c8 *unit = "cycles";
+
+		Profiler() { clear(); }
+
+		//Record the calling thread's blocks into this profiler (until detach)
+		__forceinline void attach() { current = this; }
+		static __forceinline void detach() { current = nullptr; }
+
+		static inline thread_local Profiler *current{};
+
+		__forceinline void add(u32 address, u64 weight, u64 count = 1) {
+
+			for (usz i = hash(address); ; i = (i + 1) & mask) {
+
+				Entry &e = entries[i];
+
+				if (e.address == address) {
+					e.count += count;
+					e.weight += weight;
+					break;
+				}
+
+				if (e.address == empty) {
+
+					e = { address, count, weight };
+
+					if (++used * 2 > entries.size())
+						grow();
+
+					break;
+				}
+			}
+
+			total += weight;
+		}
+
+		void clear() {
+			entries.assign(initialSize, Entry{ empty, 0, 0 });
+			mask = initialSize - 1;
+			used = 0;
+			total = 0;
+		}
+
+		//Entries sorted by weight (most expensive first)
+		List<Entry> hotSpots() const;
+
+		//Text report of the top entries:
+		//	cycles  %  count  address  symbol
+		void report(std::FILE *out, const Symbols *symbols = nullptr, usz top = 50) const;
+
+		//Flamegraph folded stacks; "function;block weight" per line
+		void folded(std::FILE *out, const Symbols *symbols = nullptr) const;
+
+		__forceinline u64 totalWeight() const { return total; }
+
+	private:
+
+		static constexpr u32 empty = ~u32(0);		//Never a block start; those are 2-byte aligned
+		static constexpr usz initialSize = 1 << 12;
+
+		List<Entry> entries;
+		usz mask{}, used{};
+		u64 total{};
+
+		__forceinline usz hash(u32 address) const {
+			return usz((address * 0x9E3779B1u) >> 7) & mask;
+		}
+
+		void grow();
+
+	};
+
+	//Instrumentation policy that profiles blocks into Profiler::current
+	//Only onBlock is used, so pairs stay fused and memory isn't probed; profiled runs run the same code as others
+
+	struct Profile : NoHooks {
+
+		static constexpr bool fetchHooks = false, accessHooks = false;
+
+		static __forceinline void onBlock(const Registers&, u32 start, usz cycles, usz) {
+			if (Profiler *p = Profiler::current)
+				p->add(start, cycles);
+		}
+
+	};
+
+	inline void Profiler::grow() {
+
+		List<Entry> old(entries.size() * 2, Entry{ empty, 0, 0 });
+		old.swap(entries);
+
+		mask = entries.size() - 1;
+
+		for (const Entry &e : old)
+			if (e.address != empty)
+				for (usz i = hash(e.address); ; i = (i + 1) & mask)
+					if (entries[i].address == empty) {
+						entries[i] = e;
+						break;
+					}
+	}
+
+	inline List<Profiler::Entry> Profiler::hotSpots() const {
+
+		List<Entry> result;
+		result.reserve(used);
+
+		for (const Entry &e : entries)
+			if (e.address != empty)
+				result.push_back(e);
+
+		std::sort(result.begin(), result.end(), [](const Entry &a, const Entry &b) {
+			return a.weight != b.weight ? a.weight > b.weight : a.address < b.address;
+		});
+
+		return result;
+	}
+
+	inline void Profiler::report(std::FILE *out, const Symbols *symbols, usz top) const {
+
+		const List<Entry> spots = hotSpots();
+		c8 name[256];
+
+		std::fprintf(out, "%16s %7s %14s %-10s %s\n", unit, "%", "count", "address", "symbol");
+
+		for (usz i = 0; i < spots.size() && i < top; ++i) {
+
+			const Entry &e = spots[i];
+			const u32 address = e.address & ~1;
+
+			if (symbols)
+				symbols->name(address, name, sizeof(name));
+			else
+				name[0] = '\0';
+
+			std::fprintf(
+				out, "%16llu %6.2f%% %14llu 0x%08X %s%s\n",
+				(unsigned long long) e.weight, total ? 100.0 * e.weight / total : 0.0,
+				(unsigned long long) e.count, address, name, e.address & 1 ? " (thumb)" : ""
+			);
+		}
+	}
+
+	inline void Profiler::folded(std::FILE *out, const Symbols *symbols) const {
+
+		c8 function[256];
+
+		for (const Entry &e : hotSpots()) {
+
+			const u32 address = e.address & ~1;
+			const Symbols::Symbol *s = symbols ? symbols->find(address) : nullptr;
+
+			if (s)
+				std::snprintf(function, sizeof(function), "%s", s->name.c_str());
+			else
+				std::snprintf(function, sizeof(function), "0x%08X", address);
+
+			std::fprintf(out, "%s;0x%08X %llu\n", function, address, (unsigned long long) e.weight);
+		}
+	}
+
+}
\ No newline at end of file
@@ -17,7 +17,7 @@ namespace arm {
 
 		static constexpr u32
 			mMask = 0x1F, tMask = 0x20, fMask = 0x40, iMask = 0x80,
-			vMask = 0x10000000, cMask = 0x20000000, zMask = 0x40000000, nMask = 0x80000000;
+			qMask = 0x8000000, vMask = 0x10000000, cMask = 0x20000000, zMask = 0x40000000, nMask = 0x80000000;
 
 		//Getters (1i,1j)
 
@@ -26,6 +26,9 @@ namespace arm {
 		__forceinline bool disableFIQ() const { return value & fMask; }			//F: if FIQs aren't allowed
 		__forceinline bool disableIRQ() const { return value & iMask; }			//I: if IRQs aren't allowed
 
+		//Q: a DSP instruction saturated or overflowed since it was last cleared (v5TE)
+		__forceinline bool saturated() const { return value & qMask; }
+
 		//V: the last operation caused a signed overflow
 		__forceinline bool overflow() const { return value & vMask; }
 
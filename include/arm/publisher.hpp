@@ -0,0 +1,142 @@
+#pragma once
+#include "instrumentation.hpp"
+#include <atomic>
+#include <cstring>
+
+namespace arm {
+
+	//Register state of a running armulator for other threads (UI, monitoring)
+	//The run loop publishes a copy of the registers at block boundaries through the Publishing policy,
+	//every interval cycles or when a reader requests it. Readers get a coherent copy through a seqlock:
+	//they never block the emulation thread and retry if they raced with a publish.
+
+	struct RegisterPublisher {
+
+		struct Snapshot {
+
+			Registers r;
+			u64 cycles;			//Cycles counted since attach when the snapshot was taken
+			u64 sequence;		//Increases with every publish
+
+			//Address of the next instruction
+			__forceinline u32 address() const { return r.pc - (r.cpsr.thumb() ? 4 : 8); }
+		};
+
+		//Cycles between publishes; 0 only publishes on request
+		usz interval = 1 << 16;
+
+		//Publish the calling thread's registers into this publisher (until detach)
+		__forceinline void attach() { current = this; }
+		static __forceinline void detach() { current = nullptr; }
+
+		static inline thread_local RegisterPublisher *current{};
+
+		//Readers
+
+		//Ask for a publish at the next block boundary
+		__forceinline void request() { requested.store(true, std::memory_order_relaxed); }
+
+		//Returns false if nothing was published yet
+		bool read(Snapshot &out) const;
+
+		//Sequence of the last publish; can be polled to see if there's something new
+		__forceinline u64 sequence() const { return seq.load(std::memory_order_acquire) >> 1; }
+
+		//Called by the policy at the end of a block
+
+		__forceinline void block(const Registers &r, usz cycles) {
+
+			total += cycles;
+
+			if ((interval && total >= next) || requested.load(std::memory_order_relaxed))
+				publish(r);
+		}
+
+		void publish(const Registers &r);
+
+	private:
+
+		static constexpr usz words = sizeof(Registers) / sizeof(u32);
+		static_assert(sizeof(Registers) % sizeof(u32) == 0, "Registers are published as 32-bit words");
+
+		//Stored as relaxed atomics, so a reader racing with a publish isn't a data race (just a retry)
+		std::atomic<u32> data[words]{};
+		std::atomic<u64> cycles{};
+
+		alignas(64) std::atomic<u64> seq{};				//Odd while a publish is in progress
+		alignas(64) std::atomic<bool> requested{};
+
+		u64 total{}, next{};
+
+	};
+
+	//Instrumentation policy that publishes into RegisterPublisher::current
+	//Only onBlock is used, so pairs stay fused and memory isn't probed
+
+	struct Publishing : NoHooks {
+
+		static constexpr bool fetchHooks = false, accessHooks = false;
+
+		static __forceinline void onBlock(const Registers &r, u32, usz cycles, usz) {
+			if (RegisterPublisher *p = RegisterPublisher::current)
+				p->block(r, cycles);
+		}
+
+	};
+
+	inline void RegisterPublisher::publish(const Registers &r) {
+
+		//Cleared before the copy; a request that comes in during the publish gets the next one
+
+		requested.exchange(false, std::memory_order_relaxed);
+
+		u32 copy[words];
+		std::memcpy(copy, &r, sizeof(copy));
+
+		const u64 s = seq.load(std::memory_order_relaxed);
+
+		seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		for (usz i = 0; i < words; ++i)
+			data[i].store(copy[i], std::memory_order_relaxed);
+
+		cycles.store(total, std::memory_order_relaxed);
+
+		seq.store(s + 2, std::memory_order_release);
+
+		next = total + interval;
+	}
+
+	inline bool RegisterPublisher::read(Snapshot &out) const {
+
+		u32 copy[words];
+		u64 s0, s1, c;
+
+		do {
+
+			s0 = seq.load(std::memory_order_acquire);
+
+			if (s0 & 1)
+				continue;
+
+			for (usz i = 0; i < words; ++i)
+				copy[i] = data[i].load(std::memory_order_relaxed);
+
+			c = cycles.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			s1 = seq.load(std::memory_order_relaxed);
+
+		} while ((s0 & 1) || s0 != s1);
+
+		if (!s0)
+			return false;
+
+		std::memcpy(&out.r, copy, sizeof(copy));
+		out.cycles = c;
+		out.sequence = s0 >> 1;
+		return true;
+	}
+
+}
\ No newline at end of file
@@ -58,24 +58,54 @@ namespace arm {
 			return spsr[Mode::toId(cpsr.mode())];
 		}
 
+		//Register in the current mode
+		u32 &reg(Register i) {
+			return registers[mapping[Mode::toId(cpsr.mode())][i]];
+		}
+
+		u32 reg(Register i) const {
+			return registers[mapping[Mode::toId(cpsr.mode())][i]];
+		}
+
+		//Mapping for the current mode; in thumb mode it starts at r8, since only high registers use it
+		const u8 *getMapping() const {
+			return mapping[Mode::toId(cpsr.mode())] + (cpsr.thumb() ? 8 : 0);
+		}
+
+		//Returns false if the exception is disabled (IRQ/FIQ)
 		template<Exception e>
-		void exception() {
+		bool exception() {
 
 			constexpr Mode::E mode = Mode::E(u32(e) >> 8);
 
 			if constexpr (mode == Mode::FIQ) {
 				if (cpsr.disableFIQ())
-					return;
+					return false;
 			}
 			else if constexpr (mode == Mode::IRQ)
 				if (cpsr.disableIRQ())
-					return;
+					return false;
 
 			spsr[Mode::toId(mode)] = cpsr;			//Save cpsr
 			cpsr.mode(mode);						//Set mode
 
-			//Save next instruction in link register
-			registers[mapping[mode][Register::lr]] = pc - (4 - cpsr.thumb() * 2);
+			//Save the return address in the link register
+			//The executing instruction (ir) is at pc - 4 in thumb and pc - 8 in arm mode
+			//SWI/UND return to the next instruction, the others use the ARM exit offsets:
+			//SUBS pc, lr, #4 for IRQ/FIQ/PREFETCH_ABORT and SUBS pc, lr, #8 for DATA_ABORT
+
+			const u32 current = pc - (cpsr.thumb() ? 4 : 8);
+			u32 link;
+
+			if constexpr (e == Exception::SWI || e == Exception::UND)
+				link = current + (cpsr.thumb() ? 2 : 4);
+
+			else if constexpr (e == Exception::DATA_ABORT)
+				link = current + 8;
+
+			else link = current + 4;
+
+			registers[mapping[Mode::toId(mode)][Register::lr]] = link;
 
 			cpsr.clearThumb();						//Switch to arm mode
 			cpsr.setIrq();							//Prevent IRQ interrupts
@@ -84,7 +114,7 @@ namespace arm {
 				cpsr.setFiq();						//Prevent FIQ interrupts
 
 			pc = u32(e) & 0xFF;							//Jump to vector address
-
+			return true;
 		}
 	};
 
@@ -0,0 +1,168 @@
+#pragma once
+#include "profiler.hpp"
+#include "spsc_queue.hpp"
+
+#ifdef __linux__
+	#include <csignal>
+	#include <ctime>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+namespace arm {
+
+	//Statistical profiler; samples the pc of a running armulator from a SIGPROF timer
+	//The timer runs on the CPU time of the emulation thread and the signal is delivered to that thread,
+	//so the handler interrupts the run loop itself and reads its registers; the run loop isn't changed or instrumented.
+	//Samples go into a lock-free ring buffer and are aggregated by drain, into the same report as the exact profiler.
+	//Only one sampler can run at a time (the signal handler is process wide); only available on Linux.
+
+	struct Sampler {
+
+		struct Sample {
+			u32 address;		//Instruction that was executing; bit 0 set for thumb
+			u8 mode;			//Mode id (Mode::toId)
+		};
+
+		Sampler() = default;
+		~Sampler() { stop(); }
+
+		Sampler(const Sampler&) = delete;
+		Sampler &operator=(const Sampler&) = delete;
+
+		//Sample the registers at the rate (in samples per second of CPU time)
+		//Has to be called from the thread that runs the armulator; returns false if a timer can't be created
+		bool start(const Registers &r, u32 hz = 1000);
+
+		void stop();
+
+		//Aggregate the samples since the last drain into the profiler (weight = samples); returns how many
+		//Can be called from any (single) thread while sampling
+		usz drain(Profiler &profiler);
+
+		//Samples per mode id (6 for invalid modes) and samples that didn't fit in the buffer, of every drain so far
+		u64 modes[7]{};
+		u64 dropped{};
+
+	private:
+
+		static constexpr usz bufferSize = 1 << 14;
+
+		SpscQueue<Sample, bufferSize> queue;
+		std::atomic<u64> overflow{};
+		const Registers *registers{};
+
+		static inline std::atomic<Sampler*> active{};
+
+		#ifdef __linux__
+
+			timer_t timer{};
+			struct sigaction previous{};
+			bool running{};
+
+			static void handler(int) {
+
+				Sampler *s = active.load(std::memory_order_acquire);
+
+				if (!s)
+					return;
+
+				//The run loop was interrupted, so the registers can be read as is
+
+				const volatile Registers &r = *s->registers;
+
+				const u32 cpsr = r.cpsr.value, pc = r.registers[Register::pc];
+				const bool thumb = cpsr & PSR::tMask;
+
+				const Sample sample{ (pc - (thumb ? 4 : 8)) | u32(thumb), Mode::toId(Mode::E(cpsr & PSR::mMask)) };
+
+				if (!s->queue.push(sample))
+					s->overflow.fetch_add(1, std::memory_order_relaxed);
+			}
+
+		#endif
+
+	};
+
+	#ifdef __linux__
+
+		inline bool Sampler::start(const Registers &r, u32 hz) {
+
+			stop();
+
+			Sampler *expected{};
+
+			if (!hz || !active.compare_exchange_strong(expected, this))
+				return false;
+
+			registers = &r;
+
+			struct sigaction action{};
+			action.sa_handler = handler;
+			action.sa_flags = SA_RESTART;
+			sigemptyset(&action.sa_mask);
+
+			if (sigaction(SIGPROF, &action, &previous)) {
+				active.store(nullptr);
+				return false;
+			}
+
+			sigevent event{};
+			event.sigev_notify = SIGEV_THREAD_ID;
+			event.sigev_signo = SIGPROF;
+			event._sigev_un._tid = pid_t(syscall(SYS_gettid));
+
+			if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer)) {
+				sigaction(SIGPROF, &previous, nullptr);
+				active.store(nullptr);
+				return false;
+			}
+
+			const long interval = long(1'000'000'000 / hz);
+
+			itimerspec spec{};
+			spec.it_interval.tv_sec = spec.it_value.tv_sec = interval / 1'000'000'000;
+			spec.it_interval.tv_nsec = spec.it_value.tv_nsec = interval % 1'000'000'000;
+
+			timer_settime(timer, 0, &spec, nullptr);
+			running = true;
+			return true;
+		}
+
+		inline void Sampler::stop() {
+
+			if (!running)
+				return;
+
+			timer_delete(timer);
+			active.store(nullptr, std::memory_order_release);
+			sigaction(SIGPROF, &previous, nullptr);
+
+			running = false;
+		}
+
+	#else
+
+		inline bool Sampler::start(const Registers&, u32) { return false; }
+		inline void Sampler::stop() {}
+
+	#endif
+
+	inline usz Sampler::drain(Profiler &profiler) {
+
+		Sample s;
+		usz n{};
+
+		profiler.unit = "samples";
+
+		while (queue.pop(s)) {
+			profiler.add(s.address, 1);
+			++modes[s.mode];
+			++n;
+		}
+
+		dropped += overflow.exchange(0, std::memory_order_relaxed);
+		return n;
+	}
+
+}
\ No newline at end of file
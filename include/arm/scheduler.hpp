@@ -0,0 +1,92 @@
+#pragma once
+#include "types/types.hpp"
+#include <algorithm>
+
+namespace arm {
+
+	struct Armulator;
+
+	//Cycle timestamped events (timers, IRQs, peripheral deadlines) ordered in a binary min-heap
+	//The run loop only compares the cycle counter with next() at block boundaries,
+	//so events fire at the first block boundary at or after their deadline.
+	//Events with the same deadline fire in the order they were scheduled.
+
+	struct Scheduler {
+
+		//Called from the run loop; arm.exception<e>() can be used to raise IRQ/FIQ
+		//when is the cycle the event was scheduled at (arm.cycles can be a bit later)
+		using Callback = void (*)(Armulator &arm, usz when, void *user);
+
+		using Handle = u64;
+
+		static constexpr usz never = ~usz(0);
+
+		//Schedule a callback at an absolute cycle
+		Handle schedule(usz when, Callback callback, void *user = nullptr) {
+
+			const Handle handle = ++counter;
+
+			events.push_back({ when, handle, callback, user });
+			std::push_heap(events.begin(), events.end(), later);
+
+			deadline = events.front().when;
+			return handle;
+		}
+
+		//Remove an event that didn't fire yet; returns false if it wasn't found
+		bool cancel(Handle handle) {
+
+			auto it = std::find_if(events.begin(), events.end(), [handle](const Event &e) { return e.handle == handle; });
+
+			if (it == events.end())
+				return false;
+
+			*it = events.back();
+			events.pop_back();
+			std::make_heap(events.begin(), events.end(), later);
+
+			deadline = events.empty() ? never : events.front().when;
+			return true;
+		}
+
+		//The first cycle an event has to fire at
+		__forceinline usz next() const { return deadline; }
+
+		__forceinline bool empty() const { return events.empty(); }
+
+		//Fire every event that is due; callbacks can schedule new events
+		void dispatch(Armulator &arm, usz now) {
+
+			while (!events.empty() && events.front().when <= now) {
+
+				std::pop_heap(events.begin(), events.end(), later);
+				const Event e = events.back();
+				events.pop_back();
+
+				e.callback(arm, e.when, e.user);
+			}
+
+			deadline = events.empty() ? never : events.front().when;
+		}
+
+	private:
+
+		struct Event {
+			usz when;
+			Handle handle;
+			Callback callback;
+			void *user;
+		};
+
+		//Heap order; earliest deadline (then earliest scheduled) on top
+		static bool later(const Event &a, const Event &b) {
+			return a.when > b.when || (a.when == b.when && a.handle > b.handle);
+		}
+
+		List<Event> events;
+		usz deadline = never;
+		Handle counter{};
+
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+#include "types/types.hpp"
+#include <atomic>
+
+namespace arm {
+
+	//Lock-free ring buffer with one producer and one consumer thread
+	//Can hold size - 1 elements; push fails when it's full instead of blocking
+
+	template<typename T, usz size>
+	struct SpscQueue {
+
+		static_assert(size >= 2 && (size & (size - 1)) == 0, "SpscQueue size has to be a power of two");
+
+		static constexpr usz mask = size - 1;
+
+		//Producer
+
+		__forceinline bool push(const T &t) {
+
+			const usz h = head.load(std::memory_order_relaxed), next = (h + 1) & mask;
+
+			if (next == tail.load(std::memory_order_acquire))
+				return false;
+
+			data[h] = t;
+			head.store(next, std::memory_order_release);
+			return true;
+		}
+
+		//Consumer
+
+		__forceinline bool pop(T &t) {
+
+			const usz t0 = tail.load(std::memory_order_relaxed);
+
+			if (t0 == head.load(std::memory_order_acquire))
+				return false;
+
+			t = data[t0];
+			tail.store((t0 + 1) & mask, std::memory_order_release);
+			return true;
+		}
+
+		//Approximate when called from another thread than the producer or consumer
+		__forceinline bool empty() const {
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+
+	private:
+
+		alignas(64) std::atomic<usz> head{};
+		alignas(64) std::atomic<usz> tail{};
+		alignas(64) T data[size];
+
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+#pragma once
+#include "types/types.hpp"
+#include <algorithm>
+#include <string>
+#include <cstdio>
+
+namespace arm {
+
+	//Function symbols of a guest image, used to name addresses in profiles
+	//Loaded from the symbol table of an ELF32 (little endian) file, like the one the ROM was linked from
+
+	struct Symbols {
+
+		struct Symbol {
+			u32 address;		//Without the thumb bit
+			u32 size;			//0 if unknown; the symbol then runs until the next one
+			std::string name;
+		};
+
+		//Returns false if it isn't an ELF32 file with a symbol table
+		bool loadElf(const u8 *data, usz size);
+
+		void add(u32 address, u32 size, const std::string &name) {
+			symbols.push_back({ address & ~1, size, name });
+			sorted = false;
+		}
+
+		//Symbol that contains the address; nullptr if there's none
+		const Symbol *find(u32 address) const;
+
+		//"symbol+0x10" or "0x08000123" if there's no symbol; returns the length
+		usz name(u32 address, c8 *buffer, usz size) const;
+
+		__forceinline bool empty() const { return symbols.empty(); }
+
+	private:
+
+		mutable List<Symbol> symbols;
+		mutable bool sorted = true;
+
+		static __forceinline u32 get32(const u8 *ptr) {
+			return u32(ptr[0]) | (u32(ptr[1]) << 8) | (u32(ptr[2]) << 16) | (u32(ptr[3]) << 24);
+		}
+
+		static __forceinline u16 get16(const u8 *ptr) {
+			return u16(ptr[0] | (ptr[1] << 8));
+		}
+
+		void sort() const {
+
+			if (sorted)
+				return;
+
+			std::sort(symbols.begin(), symbols.end(), [](const Symbol &a, const Symbol &b) { return a.address < b.address; });
+			sorted = true;
+		}
+
+	};
+
+	inline bool Symbols::loadElf(const u8 *data, usz size) {
+
+		//ELF32, little endian
+
+		if (size < 0x34 || get32(data) != 0x464C457F || data[4] != 1 || data[5] != 1)
+			return false;
+
+		const u32 shoff = get32(data + 0x20);
+		const u16 shentsize = get16(data + 0x2E), shnum = get16(data + 0x30);
+
+		if (shentsize < 0x28 || shoff > size || usz(shnum) * shentsize > size - shoff)
+			return false;
+
+		bool found = false;
+
+		for (u16 i = 0; i < shnum; ++i) {
+
+			const u8 *sh = data + shoff + usz(i) * shentsize;
+
+			if (get32(sh + 4) != 2)				//SHT_SYMTAB
+				continue;
+
+			const u32 offset = get32(sh + 0x10), bytes = get32(sh + 0x14), link = get32(sh + 0x18);
+
+			if (link >= shnum || offset > size || bytes > size - offset)
+				continue;
+
+			const u8 *strtab = data + shoff + usz(link) * shentsize;
+			const u32 strOffset = get32(strtab + 0x10), strSize = get32(strtab + 0x14);
+
+			if (strOffset > size || strSize > size - strOffset)
+				continue;
+
+			const c8 *strings = (const c8*) data + strOffset;
+
+			for (u32 j = 0; j + 16 <= bytes; j += 16) {
+
+				const u8 *sym = data + offset + j;
+				const u32 nameOffset = get32(sym);
+
+				if ((sym[12] & 0xF) != 2 || nameOffset >= strSize)		//STT_FUNC
+					continue;
+
+				const c8 *name = strings + nameOffset;
+				const usz length = std::find(name, strings + strSize, '\0') - name;
+
+				add(get32(sym + 4), get32(sym + 8), std::string(name, length));
+				found = true;
+			}
+		}
+
+		return found;
+	}
+
+	inline const Symbols::Symbol *Symbols::find(u32 address) const {
+
+		sort();
+
+		auto it = std::upper_bound(
+			symbols.begin(), symbols.end(), address, [](u32 a, const Symbol &s) { return a < s.address; }
+		);
+
+		if (it == symbols.begin())
+			return nullptr;
+
+		const Symbol &s = *--it;
+
+		if (s.size && address - s.address >= s.size)
+			return nullptr;
+
+		return &s;
+	}
+
+	inline usz Symbols::name(u32 address, c8 *buffer, usz size) const {
+
+		const Symbol *s = find(address);
+		int n;
+
+		if (!s)
+			n = snprintf(buffer, size, "0x%08X", address);
+
+		else if (address == s->address)
+			n = snprintf(buffer, size, "%s", s->name.c_str());
+
+		else
+			n = snprintf(buffer, size, "%s+0x%X", s->name.c_str(), address - s->address);
+
+		return n < 0 ? 0 : (usz(n) < size ? usz(n) : size - 1);
+	}
+
+}
\ No newline at end of file
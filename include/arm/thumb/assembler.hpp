@@ -0,0 +1,320 @@
+#pragma once
+#include "instructions.hpp"
+#include "../armulator.hpp"
+
+namespace arm::thumb {
+
+	//Assembler on top of the encoders in instructions.hpp
+	//Instructions are emitted as encoded; branches to labels and pc relative loads are emitted with a zero offset
+	//and patched when the label is bound (or right away if it already is), so labels can be used before they're bound.
+	//ldr(Rd, value) adds the value to a literal pool; pool() places the pending literals (word aligned) at the current address.
+	//LDR [pc] only reaches 1020 bytes ahead, so longer code needs a pool() somewhere it isn't executed (after a return).
+	//
+	//Output decides where the code goes:
+	//MemoryOutput writes into guest memory (Assembler),
+	//ArrayOutput into an array, so a program can be assembled at compile time (StaticAssembler).
+	//Errors (unbound labels, offsets out of range, full tables) don't stop assembling; the first one is kept in error.
+
+	struct Label {
+		u16 id;
+	};
+
+	template<typename Memory>
+	struct MemoryOutput {
+
+		Memory &memory;
+		u32 base;
+
+		__forceinline bool set(u32 offset, TI v) { memory.template set<TI>(base + offset, v); return true; }
+		__forceinline TI get(u32 offset) { return memory.template get<TI>(base + offset); }
+	};
+
+	template<usz N /* halfwords */>
+	struct ArrayOutput {
+
+		u32 base{};
+		TI code[N]{};
+
+		constexpr bool set(u32 offset, TI v) {
+
+			if (offset / 2 >= N)
+				return false;
+
+			code[offset / 2] = v;
+			return true;
+		}
+
+		constexpr TI get(u32 offset) const { return offset / 2 < N ? code[offset / 2] : 0; }
+	};
+
+	template<typename Output, usz maxLabels = 64, usz maxFixups = 128, usz maxLiterals = 64>
+	class BasicAssembler {
+
+	public:
+
+		Output out;
+		const c8 *error{};
+
+		constexpr BasicAssembler(const Output &out): out(out) {
+
+			for (usz i = 0; i < maxLabels; ++i)
+				labels[i] = unbound;
+
+			if (out.base & 1)
+				fail("Code has to be halfword aligned");
+		}
+
+		//Address of the next instruction
+		constexpr u32 address() const { return out.base + pc; }
+
+		//Bytes emitted so far
+		constexpr u32 size() const { return pc; }
+
+		//Labels
+
+		constexpr Label label() {
+
+			if (labelCount == maxLabels) {
+				fail("Too many labels");
+				return { 0 };
+			}
+
+			return { labelCount++ };
+		}
+
+		//Bind the label to the current address, resolving the branches to it
+		constexpr void bind(Label l) {
+
+			if (labels[l.id] != unbound) {
+				fail("Label bound twice");
+				return;
+			}
+
+			labels[l.id] = pc;
+
+			for (usz i = 0; i < fixupCount; )
+				if (fixups[i].label == l.id) {
+					patch(fixups[i].at, fixups[i].kind, pc);
+					fixups[i] = fixups[--fixupCount];
+				}
+				else ++i;
+		}
+
+		//A label bound to the current address
+		constexpr Label here() {
+			const Label l = label();
+			bind(l);
+			return l;
+		}
+
+		constexpr bool bound(Label l) const { return labels[l.id] != unbound; }
+
+		//Address of a bound label; add 1 for a thumb entry
+		constexpr u32 address(Label l) const { return out.base + labels[l.id]; }
+
+		//Code and data
+
+		constexpr void emit(TI ti) {
+
+			if (!out.set(pc, ti))
+				fail("Output is full");
+
+			pc += 2;
+		}
+
+		constexpr void word(u32 v) {
+			emit(TI(v));
+			emit(TI(v >> 16));
+		}
+
+		//Pad with nops up to an address that is a multiple of bytes (a power of two)
+		constexpr void align(u32 bytes) {
+			while (address() & (bytes - 1))
+				emit(nop());
+		}
+
+		//Branches
+
+		constexpr void b(Label l) { branch(TI(B << 11), B_12, l); }
+		constexpr void b(cond::Condition c, Label l) { branch(thumb::b(c, 0), B_9, l); }
+
+		//Emits both halves (BLL, BLH)
+		constexpr void bl(Label l) { branch(0, BL_23, l); }
+
+		//Branch with link to an address outside of the code
+		constexpr void bl(u32 target) {
+			const u32 at = pc;
+			emit(0);
+			emit(0);
+			patch(at, BL_23, target - out.base);
+		}
+
+		//pc relative loads
+
+		//LDR Rd, [pc, #label]; the label has to be word aligned
+		constexpr void ldr(LoReg Rd, Label l) { branch(RegOp8b{ 0, Rd, LDR_PC }.v, PC_10, l); }
+
+		//ADD Rd, pc, #label; the label has to be word aligned
+		constexpr void adr(LoReg Rd, Label l) { branch(RegOp8b{ 0, Rd, ADD_PC }.v, PC_10, l); }
+
+		//LDR Rd, =value; loads the value from the next literal pool
+		constexpr void ldr(LoReg Rd, u32 value) {
+
+			if (literalCount == maxLiterals) {
+				fail("Too many literals");
+				return;
+			}
+
+			literals[literalCount++] = { pc, value };
+			emit(RegOp8b{ 0, Rd, LDR_PC }.v);
+		}
+
+		//Place the pending literals; equal values share a word
+		constexpr void pool() {
+
+			if (!literalCount)
+				return;
+
+			align(4);
+
+			const u32 start = pc;
+
+			for (usz i = 0; i < literalCount; ++i) {
+
+				u32 at = start;
+
+				while (at < pc && (out.get(at) | (u32(out.get(at + 2)) << 16)) != literals[i].value)
+					at += 4;
+
+				if (at == pc)
+					word(literals[i].value);
+
+				patch(literals[i].at, PC_10, at);
+			}
+
+			literalCount = 0;
+		}
+
+		//Place the last pool and check that every label used was bound; returns false if there was an error
+		constexpr bool finish() {
+
+			pool();
+
+			if (fixupCount)
+				fail("Unbound label");
+
+			return !error;
+		}
+
+	private:
+
+		enum Kind : u8 {
+			B_9,			//B{cond}; -256/+254
+			B_12,			//B; -2048/+2046
+			BL_23,			//BLL + BLH; +-4 MiB
+			PC_10			//LDR/ADD Rd, [pc, #i]; 0/+1020 from the word aligned pc
+		};
+
+		struct Fixup {
+			u32 at;
+			u16 label;
+			Kind kind;
+		};
+
+		struct Literal {
+			u32 at, value;
+		};
+
+		static constexpr u32 unbound = u32(-1);
+
+		u32 labels[maxLabels]{};
+		Fixup fixups[maxFixups]{};
+		Literal literals[maxLiterals]{};
+
+		u32 pc{};
+		u16 labelCount{};
+		usz fixupCount{}, literalCount{};
+
+		constexpr void fail(const c8 *message) {
+			if (!error)
+				error = message;
+		}
+
+		constexpr void branch(TI ti, Kind kind, Label l) {
+
+			const u32 at = pc;
+			emit(ti);
+
+			if (kind == BL_23)
+				emit(0);
+
+			if (labels[l.id] != unbound)
+				patch(at, kind, labels[l.id]);
+
+			else if (fixupCount == maxFixups)
+				fail("Too many unresolved branches");
+
+			else fixups[fixupCount++] = { at, l.id, kind };
+		}
+
+		//Fill in the offset of the instruction at (offset from base) to target (offset from base)
+		//Word alignment is of the addresses, so the base doesn't have to be word aligned
+		constexpr void patch(u32 at, Kind kind, u32 target) {
+
+			if (kind == PC_10) {
+
+				const u32 offset = (out.base + target) - ((out.base + at + 4) & ~3);
+
+				if (((out.base + target) & 3) || i32(offset) < 0 || offset > 1020)
+					fail("pc relative load out of range");
+
+				else out.set(at, TI((out.get(at) & 0xFF00) | (offset >> 2)));
+
+				return;
+			}
+
+			const i32 offset = i32(target - (at + 4));
+
+			switch (kind) {
+
+				case B_9:
+
+					if (offset < -256 || offset > 254)
+						fail("Conditional branch out of range");
+
+					else out.set(at, TI((out.get(at) & 0xFF00) | ((u32(offset) >> 1) & 0xFF)));
+
+					break;
+
+				case B_12:
+
+					if (offset < -2048 || offset > 2046)
+						fail("Branch out of range");
+
+					else out.set(at, TI((B << 11) | ((u32(offset) >> 1) & 0x7FF)));
+
+					break;
+
+				default:
+
+					if (offset < -0x400000 || offset >= 0x400000)
+						fail("Branch with link out of range");
+
+					else {
+						out.set(at, bll(offset));
+						out.set(at + 2, blh(offset));
+					}
+			}
+		}
+
+	};
+
+	//Assembles into the memory of an armulator
+	using Assembler = BasicAssembler<MemoryOutput<Armulator::Memory>>;
+
+	//Assembles into an array; usable in constant expressions with the constexpr encoders
+	//(the ones with Value parameters and addSp aren't constexpr)
+	template<usz N, usz maxLabels = 16, usz maxFixups = 32, usz maxLiterals = 16>
+	using StaticAssembler = BasicAssembler<ArrayOutput<N>, maxLabels, maxFixups, maxLiterals>;
+
+}
\ No newline at end of file
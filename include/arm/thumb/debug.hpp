@@ -2,8 +2,9 @@
 #include "types/types.hpp"
 #include "../armulator.hpp"
 #include "opcodes.hpp"
-#include <unordered_map>
-#include <sstream>
+#include "values.hpp"
+#include <array>
+#include <thread>
 
 namespace arm::thumb {
 
@@ -35,135 +36,172 @@ namespace arm::thumb {
 		"POP",	"POP",	"BKPT",	""
 	};
 
-	static ::std::unordered_map<usz, const c8*> names7 {
-		{ ADD_3B, "ADD" },
-		{ ADD_R, "ADD" },
-		{ SUB_3B, "SUB" },
-		{ SUB_R, "SUB" },
-		{ STR, "STR" },
-		{ STRH, "STRH" },
-		{ STRB, "STRB" },
-		{ LDSB, "LDSB" },
-		{ LDR, "LDR" },
-		{ LDRH, "LDRH" },
-		{ LDRB, "LDRB" },
-		{ LDSH, "LDSH" }
-	};
+	//Extended opcodes; indexed by the opcode, so names are looked up without hashing
 
-	static ::std::unordered_map<usz, const c8*> names10 {
-		{ AND,			"AND" },
-		{ EOR,			"EOR" },
-		{ LSL_R,		"LSL" },
-		{ LSR_R,		"LSR" },
-		{ ASR_R,		"ASR" },
-		{ ADC, 			"ADC" },
-		{ SBC, 			"SBC" },
-		{ ROR, 			"ROR" },
-		{ TST, 			"TST" },
-		{ NEG, 			"NEG" },
-		{ CMP_R,		"CMP" },
-		{ CMN,			"CMN" },
-		{ ORR,			"ORR" },
-		{ MUL,			"MUL" },
-		{ BIC,			"BIC" },
-		{ MVN,			"MVN" },
-		{ ADD_LO_HI,	"ADD" },
-		{ ADD_HI_LO,	"ADD" },
-		{ ADD_HI_HI,	"ADD" },
-		{ CMP_LO_HI,	"CMP" },
-		{ CMP_HI_LO,	"CMP" },
-		{ CMP_HI_HI,	"CMP" },
-		{ MOV_LO_HI,	"MOV" },
-		{ MOV_HI_LO,	"MOV" },
-		{ MOV_HI_HI,	"MOV" },
-		{ BX_LO,		"BX" },
-		{ BX_HI,		"BX" },
-	};
+	static constexpr auto names7 = []() {
 
-	//Print functions
+		std::array<const c8*, 128> n{};
 
-	bool print(std::stringstream &ss) {
-		oic::System::log()->debug(ss.str());
-		return true;
-	}
+		n[ADD_3B] = n[ADD_R] = "ADD";
+		n[SUB_3B] = n[SUB_R] = "SUB";
+		n[STR] = "STR";
+		n[STRH] = "STRH";
+		n[STRB] = "STRB";
+		n[LDSB] = "LDSB";
+		n[LDR] = "LDR";
+		n[LDRH] = "LDRH";
+		n[LDRB] = "LDRB";
+		n[LDSH] = "LDSH";
 
-	bool printUndef(std::stringstream &ss, u32 instr) {
-		ss << "DATA #" << instr;
-		return print(ss);
-	}
+		return n;
+	}();
 
-	bool print(std::stringstream &ss, const c8 *s, i32 intermediate) {
-		ss << s << " #" << intermediate;
-		return print(ss);
-	}
+	//Only ALU_HI_BX opcodes are in here, so the table starts at ALU_HI_BX << 5
 
-	bool printr(std::stringstream &ss, const c8 *s, u32 Rd) {
-		ss << s << " r" << Rd;
-		return print(ss);
-	}
+	static constexpr auto names10 = []() {
 
-	bool print(std::stringstream &ss, const c8 *s, u32 Rd, u32 Rs, i32 intermediate) {
-		ss << s << " r" << Rd << ", r" << Rs << ", #" << intermediate;
-		return print(ss);
-	}
+		std::array<const c8*, 64> n{};
 
-	bool printr(std::stringstream &ss, const c8 *s, u32 Rd, u32 Rs, u32 Rb) {
-		ss << s << " r" << Rd << ", r" << Rs << ", r" << Rb;
-		return print(ss);
-	}
+		constexpr u16 base = ALU_HI_BX << 5;
 
-	bool print(std::stringstream &ss, const c8 *s, u32 Rd, i32 intermediate) {
-		ss << s << " r" << Rd << ", #" << intermediate;
-		return print(ss);
-	}
+		n[AND - base] = "AND";
+		n[EOR - base] = "EOR";
+		n[LSL_R - base] = "LSL";
+		n[LSR_R - base] = "LSR";
+		n[ASR_R - base] = "ASR";
+		n[ADC - base] = "ADC";
+		n[SBC - base] = "SBC";
+		n[ROR - base] = "ROR";
+		n[TST - base] = "TST";
+		n[NEG - base] = "NEG";
+		n[CMP_R - base] = "CMP";
+		n[CMN - base] = "CMN";
+		n[ORR - base] = "ORR";
+		n[MUL - base] = "MUL";
+		n[BIC - base] = "BIC";
+		n[MVN - base] = "MVN";
+		n[ADD_LO_HI - base] = n[ADD_HI_LO - base] = n[ADD_HI_HI - base] = "ADD";
+		n[CMP_LO_HI - base] = n[CMP_HI_LO - base] = n[CMP_HI_HI - base] = "CMP";
+		n[MOV_LO_HI - base] = n[MOV_HI_LO - base] = n[MOV_HI_HI - base] = "MOV";
+		n[BX_LO - base] = n[BX_HI - base] = "BX";
 
-	bool printr(std::stringstream &ss, const c8 *s, u32 Rd, u32 Rs) {
-		ss << s << " r" << Rd << ", r" << Rs;
-		return print(ss);
-	}
+		return n;
+	}();
 
-	bool printv(std::stringstream &ss, const c8 *op, u32 Rd, u8 v, u32 Rs) {
+	//Text output into a caller provided buffer; never writes past the end and always null terminates
+	//Everything is constexpr, so disassembly also works at compile time
 
-		bool prev = false;
-		ss << op << " r" << Rd << " { ";
+	struct Text {
 
-		for (usz i = 0; i < 8; ++i)
-			if (v & (1 << i)) {
+		c8 *ptr, *end;
 
-				if (prev) ss << ", ";
-				else prev = true;
+		__forceinline constexpr void put(c8 c) {
+			if (ptr < end)
+				*ptr++ = c;
+		}
 
-				ss << 'r' << i;
+		__forceinline constexpr void put(const c8 *s) {
+			while (*s)
+				put(*s++);
+		}
+
+		constexpr void put(i32 v) {
+
+			u32 u = u32(v);
+
+			if (v < 0) {
+				put('-');
+				u = 0 - u;
 			}
 
-		ss << (prev ? ", r" : "r") << Rs << " }";
-		return print(ss);
+			putUnsigned(u);
+		}
+
+		constexpr void putUnsigned(u32 u) {
+
+			c8 digits[10]{};
+			usz n{};
+
+			do {
+				digits[n++] = c8('0' + u % 10);
+				u /= 10;
+			} while (u);
+
+			while (n)
+				put(digits[--n]);
+		}
+
+		__forceinline constexpr void reg(u32 r) {
+			put('r');
+			putUnsigned(r);
+		}
+
+	};
+
+	//Print functions
+	//Same text as the original stream based printing; "OP rD, rS, #i"
+
+	constexpr void print(Text &t, const c8 *s, i32 intermediate) {
+		t.put(s); t.put(" #"); t.put(intermediate);
+	}
+
+	constexpr void printr(Text &t, const c8 *s, u32 Rd) {
+		t.put(s); t.put(' '); t.reg(Rd);
+	}
+
+	constexpr void print(Text &t, const c8 *s, u32 Rd, u32 Rs, i32 intermediate) {
+		t.put(s); t.put(' '); t.reg(Rd); t.put(", "); t.reg(Rs); t.put(", #"); t.put(intermediate);
+	}
+
+	constexpr void printr(Text &t, const c8 *s, u32 Rd, u32 Rs, u32 Rb) {
+		t.put(s); t.put(' '); t.reg(Rd); t.put(", "); t.reg(Rs); t.put(", "); t.reg(Rb);
 	}
 
-	bool printv(std::stringstream &ss, const c8 *op, u32 Rd, u8 v) {
+	constexpr void print(Text &t, const c8 *s, u32 Rd, i32 intermediate) {
+		t.put(s); t.put(' '); t.reg(Rd); t.put(", #"); t.put(intermediate);
+	}
+
+	constexpr void printr(Text &t, const c8 *s, u32 Rd, u32 Rs) {
+		t.put(s); t.put(' '); t.reg(Rd); t.put(", "); t.reg(Rs);
+	}
+
+	//Register list; extra is appended (lr/pc) unless it's 0
+
+	constexpr void printv(Text &t, const c8 *op, u32 Rd, u8 v, u32 extra = 0) {
 
 		bool prev = false;
-		ss << op << " r" << Rd << " { ";
 
-		for (usz i = 0; i < 8; ++i)
+		t.put(op); t.put(' '); t.reg(Rd); t.put(" { ");
+
+		for (u32 i = 0; i < 8; ++i)
 			if (v & (1 << i)) {
 
-				if (prev) ss << ", ";
+				if (prev) t.put(", ");
 				else prev = true;
 
-				ss << 'r' << i;
+				t.reg(i);
 			}
 
-		ss << " }";
-		return print(ss);
+		if (extra) {
+			t.put(prev ? ", " : "");
+			t.reg(extra);
+		}
+
+		t.put(" }");
 	}
 
-	//Print instruction set
+	//Disassemble a thumb instruction; nir is only used by BL/BLX (the second half)
+	//Returns the length of the text, excluding the null terminator
+
+	static constexpr usz maxDisassembly = 63;
 
 	template<arm::Armulator::Version v>
-	_inline_ bool printThumb(arm::Registers &r) {
+	constexpr usz disassemble(u32 ir, u32 nir, c8 *buffer, usz size = maxDisassembly + 1) {
 
-		std::stringstream ss;
+		struct { u32 ir, nir; } r{ ir, nir };
+
+		Text t{ buffer, buffer + size - 1 };
+		bool undef{};
 
 		switch (Op5_11 /* fetch first 5 bits of opcode */) {
 
@@ -172,40 +210,65 @@ namespace arm::thumb {
 			case ASR:
 			case STRBi:
 			case LDRBi:
-				return print(ss, names5[Op5_11], Rd3_0, Rs3_3, i5_6);
+				print(t, names5[Op5_11], Rd3_0, Rs3_3, i5_6);
+				break;
 
 			case STRi:
 			case LDRi:
-				return print(ss, names5[Op5_11], Rd3_0, Rs3_3, i5_6_2);
+				print(t, names5[Op5_11], Rd3_0, Rs3_3, i5_6_2);
+				break;
 
 			case STRHi:
 			case LDRHi:
-				return print(ss, names5[Op5_11], Rd3_0, Rs3_3, i5_6_1);
+				print(t, names5[Op5_11], Rd3_0, Rs3_3, i5_6_1);
+				break;
 
 			case MOV:
 			case CMP:
 			case ADD:
 			case SUB:
-				return print(ss, names5[Op5_11], Rd3_8, i8_0);
+				print(t, names5[Op5_11], Rd3_8, i8_0);
+				break;
 
 			case STR_SP:
 			case LDR_SP:
 			case ADD_SP:
-				return print(ss, names5[Op5_11], Rd3_8, arm::sp, i8_0_2);
+				print(t, names5[Op5_11], Rd3_8, arm::sp, i8_0_2);
+				break;
 
 			case LDR_PC:
 			case ADD_PC:
-				return print(ss, names5[Op5_11], Rd3_8, arm::pc, i8_0_2);
+				print(t, names5[Op5_11], Rd3_8, arm::pc, i8_0_2);
+				break;
+
+			//ADD SP, #i shares its 5-bit opcode with PUSH
 
 			case INCR_SP:
-				return print(ss, names5[Op5_11], arm::sp, r.ir & 0x80 ? -i32(i7_0_2) : i7_0_2);
+
+				switch (Op8_8) {
+
+					case PUSH:
+						printv(t, names4[Op8_8 - PUSH], arm::sp, i8_0);
+						break;
+
+					case PUSH_LR:
+						printv(t, names4[Op8_8 - PUSH], arm::sp, i8_0, arm::lr);
+						break;
+
+					default:
+						print(t, names5[Op5_11], arm::sp, r.ir & 0x80 ? -i32(i7_0_2) : i32(i7_0_2));
+				}
+
+				break;
 
 			case STMIA:
 			case LDMIA:
-				return printv(ss, names5[Op5_11], Rd3_8, i8_0);
+				printv(t, names5[Op5_11], Rd3_8, i8_0);
+				break;
 
 			case B:
-				return print(ss, names5[Op5_11], i32(s12));
+				print(t, names5[Op5_11], i32(s12));
+				break;
 
 			case B0:
 			case B1:
@@ -228,37 +291,44 @@ namespace arm::thumb {
 					case BGT:
 					case BLE:
 					case BAL:
-						return print(ss, conditions[Op8_8 & 0xF], u32(i8(i8_0)) << 1);
+						print(t, conditions[Op8_8 & 0xF], i32(u32(i8(i8_0)) << 1));
+						break;
 
 					case SWI:
-						return print(ss, conditions[Op8_8 & 0xF], i8_0);
+						print(t, conditions[Op8_8 & 0xF], i32(i8_0));
+						break;
 
-					case PUSH:
 					case POP:
-						return printv(ss, names4[Op8_8 - PUSH], arm::sp, i8_0);
-
-					case PUSH_LR:
-						return printv(ss, names4[Op8_8 - PUSH], arm::sp, i8_0, lr);
+						printv(t, names4[Op8_8 - PUSH], arm::sp, i8_0);
+						break;
 
 					case POP_PC:
-						return printv(ss, names4[Op8_8 - PUSH], arm::sp, i8_0, pc);
+						printv(t, names4[Op8_8 - PUSH], arm::sp, i8_0, arm::pc);
+						break;
 
 					case BKPT:
 
-						if constexpr ((v & 0xFF) >= arm::Armulator::VersionSpec::v5)
-							return print(ss, names4[Op8_8 - PUSH], i8_0);
+						if constexpr ((v & 0xFF) >= arm::Armulator::VersionSpec::v5) {
+							print(t, names4[Op8_8 - PUSH], i32(i8_0));
+							break;
+						}
 
 					default:
-						goto undef;
+						undef = true;
 				}
 
+				break;
+
 			case BLX:
 
-				if constexpr ((v & 0xFF) < arm::Armulator::VersionSpec::v5)
-					goto undef;
+				if constexpr ((v & 0xFF) < arm::Armulator::VersionSpec::v5) {
+					undef = true;
+					break;
+				}
 
 			case BLL:
-				return print(ss, names5[Op5_11], s23);
+				print(t, names5[Op5_11], i32(s23));
+				break;
 
 			case ADD_SUB:
 			case ST:
@@ -276,17 +346,23 @@ namespace arm::thumb {
 					case LDRH:
 					case LDRB:
 					case LDSH:
-						return printr(ss, names7[Op7_9], Rd3_0, Rs3_3, Rni3_6);
+						printr(t, names7[Op7_9], Rd3_0, Rs3_3, Rni3_6);
+						break;
 
 					case ADD_3B:
 					case SUB_3B:
-						return print(ss, names7[Op7_9], Rd3_0, Rs3_3, i32(Rni3_6));
-						
+						print(t, names7[Op7_9], Rd3_0, Rs3_3, i32(Rni3_6));
+						break;
+
 					default:
-						goto undef;
+						undef = true;
 				}
 
+				break;
+
 			case ALU_HI_BX:
+			{
+				const c8 *name = names10[Op10_6 - (ALU_HI_BX << 5)];
 
 				switch (Op10_6) {
 
@@ -306,36 +382,167 @@ namespace arm::thumb {
 					case MUL:
 					case BIC:
 					case MVN:
-						return printr(ss, names10[Op10_6], Rd3_0, Rs3_3);
+						printr(t, name, Rd3_0, Rs3_3);
+						break;
 
 					case ADD_LO_HI:
 					case CMP_LO_HI:
 					case MOV_LO_HI:
-						return printr(ss, names10[Op10_6], Rd3_0 | 8, Rs3_3);
+						printr(t, name, Rd3_0 | 8, Rs3_3);
+						break;
 
 					case ADD_HI_LO:
 					case CMP_HI_LO:
 					case MOV_HI_LO:
-						return printr(ss, names10[Op10_6], Rd3_0, Rs3_3 | 8);
+						printr(t, name, Rd3_0, Rs3_3 | 8);
+						break;
 
 					case ADD_HI_HI:
 					case CMP_HI_HI:
 					case MOV_HI_HI:
-						return printr(ss, names10[Op10_6], Rd3_0 | 8, Rs3_3 | 8);
+						printr(t, name, Rd3_0 | 8, Rs3_3 | 8);
+						break;
 
 					case BX_LO:
-						return printr(ss, names10[Op10_6], Rd3_0);
+						printr(t, name, Rd3_0);
+						break;
 
 					case BX_HI:
-						return printr(ss, names10[Op10_6], Rd3_0 | 8);
+						printr(t, name, Rd3_0 | 8);
+						break;
 
 					default:
-						goto undef;
+						undef = true;
 				}
+
+				break;
+			}
+
+			default:
+				undef = true;
+		}
+
+		if (undef) {
+			t.ptr = buffer;
+			t.put("DATA #");
+			t.putUnsigned(r.ir);
+		}
+
+		*t.ptr = '\0';
+		return usz(t.ptr - buffer);
+	}
+
+	//Disassemble at compile time and compare against the expected text
+
+	template<arm::Armulator::Version v>
+	constexpr bool disassemblesTo(u32 ir, const c8 *expected) {
+
+		c8 buffer[maxDisassembly + 1]{};
+		disassemble<v>(ir, 0, buffer);
+
+		usz i{};
+
+		for (; expected[i]; ++i)
+			if (buffer[i] != expected[i])
+				return false;
+
+		return !buffer[i];
+	}
+
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0x202A, "MOV r0, #42"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0x18D1, "ADD r1, r2, r3"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0x4348, "MUL r0, r1"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0xB510, "PUSH r13 { r4, r14 }"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0xB082, "ADD r13, #-8"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0xBD01, "POP r13 { r0, r15 }"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM7TDMI>(0xBE01, "DATA #48641"), "Thumb disassembly is wrong");
+	static_assert(disassemblesTo<arm::Armulator::ARM9TDMI>(0xBE01, "BKPT #1"), "Thumb disassembly is wrong");
+
+	//Print the instruction in r.ir
+
+	template<arm::Armulator::Version v>
+	_inline_ bool printThumb(arm::Registers &r) {
+
+		c8 buffer[maxDisassembly + 1];
+		disassemble<v>(r.ir, r.nir, buffer);
+
+		oic::System::log()->debug(buffer);
+		return true;
+	}
+
+	//Disassemble a range of thumb code; out(address, text, length) is called for every instruction in order
+
+	template<arm::Armulator::Version v, typename Memory, typename Out>
+	void disassemble(Memory &memory, u32 start, u32 end, Out &&out) {
+
+		c8 buffer[maxDisassembly + 1];
+
+		for (u32 address = start & ~1; address < end; address += 2) {
+
+			const u32 ir = memory.template get<u16>(address);
+			const u32 nir = address + 2 < end ? memory.template get<u16>(address + 2) : 0;
+
+			out(address, (const c8*) buffer, disassemble<v>(ir, nir, buffer));
 		}
+	}
+
+	//Fixed size line of a bulk disassembly; instruction i of the range is line i
+
+	struct DisassemblyLine {
+		c8 text[maxDisassembly + 1];
+	};
+
+	//Disassemble size bytes of thumb code (e.g. a ROM) into lines (size / 2 of them)
+	//Lines have a fixed size, so the range is split over threads without any merging
+	//threads = 0 uses the hardware concurrency
+
+	template<arm::Armulator::Version v>
+	void disassembleParallel(const u8 *data, usz size, DisassemblyLine *lines, usz threads = 0) {
+
+		const usz count = size / 2;
+
+		auto work = [data, count, lines](usz begin, usz end) {
+			for (usz i = begin; i < end; ++i) {
+
+				const u32 ir = u32(data[i * 2]) | (u32(data[i * 2 + 1]) << 8);
+				const u32 nir = i + 1 < count ? u32(data[i * 2 + 2]) | (u32(data[i * 2 + 3]) << 8) : 0;
+
+				disassemble<v>(ir, nir, lines[i].text);
+			}
+		};
+
+		if (!threads)
+			threads = std::thread::hardware_concurrency();
+
+		//Not worth starting threads for small ranges
+
+		static constexpr usz minPerThread = 1 << 14;
+
+		if (threads > count / minPerThread)
+			threads = count / minPerThread;
+
+		if (threads <= 1) {
+			work(0, count);
+			return;
+		}
+
+		List<std::thread> pool;
+		pool.reserve(threads - 1);
+
+		const usz perThread = (count + threads - 1) / threads;
+
+		for (usz t = 1; t < threads; ++t) {
+
+			const usz begin = t * perThread, end = begin + perThread < count ? begin + perThread : count;
+
+			if (begin < end)
+				pool.emplace_back(work, begin, end);
+		}
+
+		work(0, perThread < count ? perThread : count);
 
-	undef:
-		return printUndef(ss, r.ir);
+		for (std::thread &t : pool)
+			t.join();
 	}
 
 }
\ No newline at end of file
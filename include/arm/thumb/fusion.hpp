@@ -0,0 +1,158 @@
+#pragma once
+#include "../registers.hpp"
+#include "../instrumentation.hpp"
+#include "opcodes.hpp"
+#include <cstdio>
+
+namespace arm::thumb {
+
+	//Superinstructions; pairs of thumb instructions that are dispatched to one handler (stepPair)
+	//The second instruction of a pair is already in nir, so the handler knows it without decoding it again.
+	//Flags, cycles, memory accesses and the pipeline end up exactly as if both ran on their own;
+	//only flags that the second instruction overwrites are skipped.
+	//
+	//Which pairs are fused is decided at runtime from a profile of the program itself:
+	//run it with the PairProfile policy, then Fusion::choose picks the pairs that are common enough.
+	//Fusion is skipped while instrumenting or printing; those need every instruction.
+
+	enum class Pair : u8 {
+		NONE,
+		CMP_BCC,			//CMP Rd, #i / CMP Rd, Rs; B{cond} (not AL)
+		MOV_ADD,			//MOV Rd, #i; ADD Rd, #i / ADD Rd, Rs, Rn / ADD Rd, Rs, #i
+		LDR_ADD,			//LDR Rd, [Rb, #i] / LDR Rd, [sp, #i]; ADD (like MOV_ADD)
+		LSL_ASR,			//LSL Rd, Rs, #n; ASR Rd, Rd, #n (sign extension); n != 0
+		PUSH_SUB_SP,		//PUSH {.., lr}; SUB sp, #i (function prologue)
+		COUNT
+	};
+
+	static constexpr const c8 *pairNames[] = {
+		"none", "cmp+bcc", "mov+add", "ldr+add", "lsl+asr", "push+sub sp"
+	};
+
+	//The pair ir and nir make up (NONE if they don't)
+	//The first instructions of pairs are never the second of another, so pairs don't overlap
+
+	_inline_ Pair pairOf(u32 ir, u32 nir) {
+
+		const u32 op = nir >> 9;
+		const bool add = (nir >> 11) == ADD || op == ADD_R || op == ADD_3B;
+		const bool bcc = (nir >> 8) >= BEQ && (nir >> 8) <= BLE;
+
+		switch (ir >> 11) {
+
+			case CMP:
+				return bcc ? Pair::CMP_BCC : Pair::NONE;
+
+			case ALU_HI_BX:
+				return (ir >> 6) == CMP_R && bcc ? Pair::CMP_BCC : Pair::NONE;
+
+			case MOV:
+				return add ? Pair::MOV_ADD : Pair::NONE;
+
+			case LDRi:
+			case LDR_SP:
+				return add ? Pair::LDR_ADD : Pair::NONE;
+
+			case LSL: {
+
+				const u32 n = (ir >> 6) & 0x1F, d = ir & 7;
+
+				return n && (nir >> 6) == ((ASR << 5) | n) && (nir & 7) == d && ((nir >> 3) & 7) == d ?
+					Pair::LSL_ASR : Pair::NONE;
+			}
+
+			case INCR_SP:
+				return (ir >> 8) == PUSH_LR && (nir & 0xFF80) == 0xB080 ? Pair::PUSH_SUB_SP : Pair::NONE;
+
+			default:
+				return Pair::NONE;
+		}
+	}
+
+	//How often each pair occurs in the executed thumb instructions
+
+	struct PairProfiler {
+
+		u64 counts[usz(Pair::COUNT)]{};
+		u64 instructions{};
+
+		//Record the calling thread's instructions into this profiler (until detach)
+		__forceinline void attach() { current = this; }
+		static __forceinline void detach() { current = nullptr; }
+
+		static inline thread_local PairProfiler *current{};
+
+		__forceinline void add(u32 ir, u32 nir) {
+			++counts[usz(pairOf(ir, nir))];
+			++instructions;
+		}
+
+		void clear() { *this = PairProfiler{}; }
+
+		//Text report; instructions each pair covers:
+		//	pair  count  %
+		void report(std::FILE *out) const;
+
+	};
+
+	//Instrumentation policy that counts pairs into PairProfiler::current
+
+	struct PairProfile : NoHooks {
+
+		static __forceinline void onFetch(const Registers &r, u32, u32 ir) {
+			if (PairProfiler *p = PairProfiler::current)
+				if (r.cpsr.thumb())
+					p->add(ir, r.nir);
+		}
+
+	};
+
+	//The pairs the run loop fuses
+
+	struct Fusion {
+
+		u32 pairs{};			//Bit per Pair (never NONE); 0 runs every instruction on its own
+
+		static constexpr u32 bit(Pair p) { return 1u << u32(p); }
+
+		__forceinline bool fuses(Pair p) const { return pairs & bit(p); }
+
+		void enable(Pair p) { pairs |= bit(p) & ~bit(Pair::NONE); }
+		void disable(Pair p) { pairs &= ~bit(p); }
+
+		//Fuse the pairs that cover at least minShare of the profiled instructions (and nothing else)
+		//Returns the number of pairs fused
+		usz choose(const PairProfiler &profile, f64 minShare = 0.01);
+
+	};
+
+	inline void PairProfiler::report(std::FILE *out) const {
+
+		std::fprintf(out, "%-12s %14s %7s\n", "pair", "count", "%");
+
+		for (usz i = 1; i < usz(Pair::COUNT); ++i)
+			std::fprintf(
+				out, "%-12s %14llu %6.2f%%\n", pairNames[i], (unsigned long long) counts[i],
+				instructions ? 200.0 * counts[i] / instructions : 0.0
+			);
+	}
+
+	inline usz Fusion::choose(const PairProfiler &profile, f64 minShare) {
+
+		pairs = 0;
+
+		if (!profile.instructions)
+			return 0;
+
+		usz chosen{};
+
+		for (usz i = 1; i < usz(Pair::COUNT); ++i)
+			if (2.0 * profile.counts[i] >= minShare * profile.instructions) {
+				enable(Pair(i));
+				++chosen;
+			}
+
+		return chosen;
+	}
+
+}
\ No newline at end of file
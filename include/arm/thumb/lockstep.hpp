@@ -0,0 +1,828 @@
+#pragma once
+#include "arm/thumb/tharmulator_source.hpp"
+
+//Lockstep execution of one thumb program over multiple armulators (lanes)
+//Registers are kept as structure of arrays ([register][lane]) so one decoded instruction is executed
+//for every lane with a fixed trip count loop; this is what the compiler vectorizes (AVX2/AVX-512 when enabled).
+//Only control flow is shared; every lane still has its own memory.
+//Instructions that aren't lane parallel (hi register pc access, BX, BL, PUSH/POP, LDMIA/STMIA, SWI, ...)
+//are executed per lane through stepThumb after which the lanes are converged again.
+//Lanes that end up at a different pc (or leave thumb mode) are masked off and handed back to their armulator,
+//so they can be resumed by the scalar stepThumb path.
+
+namespace arm::thumb {
+
+	template<arm::Armulator::Version v, usz lanes = 8>
+	struct Lockstep {
+
+		static_assert(lanes > 0 && lanes <= 32, "Lockstep requires 1-32 lanes (lane mask is 32-bit)");
+
+		static constexpr u32 allLanes = u32(u64(1) << lanes) - 1;
+
+		static constexpr u32 flagMask = PSR::nMask | PSR::zMask | PSR::cMask | PSR::vMask;
+
+		//Structure of arrays; one row per register so every lane is contiguous
+
+		struct alignas(64) Lanes {
+			u32 loReg[8][lanes];
+			u32 hiReg[7][lanes];		//r8-r14 of the lane's mode; pc is shared
+			u32 cpsr[lanes];
+		};
+
+		Lanes l{};
+		usz cycles[lanes]{};			//Per lane since creation; added to the lane's armulator when it's released
+
+		//Create a lockstep group from armulators that have a filled pipeline (thumb mode)
+		//The largest group of lanes that share the same pc will be executed, the others are diverged
+
+		Lockstep(arm::Armulator *const (&armulators)[lanes]) {
+
+			for (usz i = 0; i < lanes; ++i)
+				cores[i] = armulators[i];
+
+			converge(allLanes);
+		}
+
+		~Lockstep() {
+			sync();
+			release(activeLanes);
+		}
+
+		Lockstep(const Lockstep&) = delete;
+		Lockstep(Lockstep&&) = delete;
+		Lockstep &operator=(const Lockstep&) = delete;
+		Lockstep &operator=(Lockstep&&) = delete;
+
+		//Lanes that are still executed in lockstep
+		__forceinline u32 active() const { return activeLanes; }
+
+		//Lanes that left the group; their state is in their armulator
+		__forceinline u32 diverged() const { return allLanes & ~activeLanes; }
+
+		//Execute up to n instructions on the active lanes
+		//Returns the number of instructions executed (less than n if all lanes diverged)
+		usz run(usz n);
+
+		//Write the state of the active lanes back into their armulators
+		void sync();
+
+	private:
+
+		arm::Armulator *cores[lanes];
+
+		u32 activeLanes{}, leader{};
+		u32 pc{}, ir{}, nir{};
+
+		template<typename F>
+		__forceinline void all(F f) {
+			for (usz i = 0; i < lanes; ++i)
+				f(i);
+		}
+
+		//Lanes with side effects (memory) only run over the active mask
+		template<typename F>
+		__forceinline void each(F f) {
+			for (u32 mask = activeLanes; mask; mask &= mask - 1)
+				f(usz(arm::ctz(mask)));
+		}
+
+		//Only lanes that run the instruction take its time
+		__forceinline void addCycles(usz c) { each([&](usz i) { cycles[i] += c; }); }
+
+		usz released[lanes]{};
+
+		//Hand the cycles of lanes that leave the group to their armulator
+		void release(u32 mask) {
+			for (; mask; mask &= mask - 1) {
+				const usz i = usz(arm::ctz(mask));
+				cores[i]->cycles += cycles[i] - released[i];
+				released[i] = cycles[i];
+			}
+		}
+
+		__forceinline arm::Armulator::Memory &memory(usz i) { return cores[i]->memory; }
+
+		//Branch-free flag helpers
+
+		static __forceinline u32 nz(u32 res) {
+			return (res & PSR::nMask) | (u32(res == 0) << 30);
+		}
+
+		static __forceinline u32 setFlags(u32 cpsr, u32 mask, u32 flags) {
+			return (cpsr & ~mask) | flags;
+		}
+
+		static __forceinline u32 addFlags(u32 a, u32 b, u32 res) {
+			return nz(res) | (u32(res < a) << 29) | (((~(a ^ b) & (a ^ res)) >> 31) << 28);
+		}
+
+		static __forceinline u32 subFlags(u32 a, u32 b, u32 res) {
+			return nz(res) | (u32(a >= b) << 29) | ((((a ^ b) & (a ^ res)) >> 31) << 28);
+		}
+
+		__forceinline void fetch() {
+			ir = nir;
+			nir = memory(leader).template get<u16>(pc);
+			pc += 2;
+		}
+
+		__forceinline void refill() {
+			fetch();
+			fetch();
+		}
+
+		//Load lanes from their armulator and mask off the ones that don't follow the majority pc
+		void converge(u32 mask);
+
+		//Execute the current instruction for every lane separately and converge again
+		void scalar();
+
+		//Execute the current instruction in lockstep; returns false if it isn't lane parallel
+		bool lockstep();
+	};
+
+	template<arm::Armulator::Version v, usz lanes>
+	void Lockstep<v, lanes>::sync() {
+
+		each([&](usz i) {
+
+			arm::Registers &r = cores[i]->r;
+			const u8 *m = Registers::mapping[Mode::toId(PSR{ l.cpsr[i] }.mode())];
+
+			for (usz j = 0; j < 8; ++j)
+				r.loReg[j] = l.loReg[j][i];
+
+			for (usz j = 0; j < 7; ++j)
+				r.registers[m[8 + j]] = l.hiReg[j][i];
+
+			r.cpsr.value = l.cpsr[i];
+			r.pc = pc;
+			r.ir = ir;
+			r.nir = nir;
+		});
+	}
+
+	template<arm::Armulator::Version v, usz lanes>
+	void Lockstep<v, lanes>::converge(u32 mask) {
+
+		//Find the pc most lanes are at (only thumb lanes can participate)
+
+		u32 best{}, bestCount{};
+
+		for (u32 i = 0; i < lanes; ++i) {
+
+			arm::Registers &r = cores[i]->r;
+
+			if (!(mask >> i & 1) || !r.cpsr.thumb())
+				continue;
+
+			u32 group{};
+
+			for (u32 j = i; j < lanes; ++j)
+				if ((mask >> j & 1) && cores[j]->r.cpsr.thumb() && cores[j]->r.pc == r.pc)
+					group |= 1 << j;
+
+			u32 count = u32(arm::popcount(group));
+
+			if (count > bestCount) {
+				best = group;
+				bestCount = count;
+			}
+		}
+
+		activeLanes = best;
+		release(mask & ~activeLanes);
+
+		if (!activeLanes)
+			return;
+
+		leader = u32(arm::ctz(activeLanes));
+
+		arm::Registers &lr = cores[leader]->r;
+		pc = lr.pc;
+		ir = lr.ir;
+		nir = lr.nir;
+
+		each([&](usz i) {
+
+			arm::Registers &r = cores[i]->r;
+			const u8 *m = Registers::mapping[Mode::toId(r.cpsr.mode())];
+
+			for (usz j = 0; j < 8; ++j)
+				l.loReg[j][i] = r.loReg[j];
+
+			for (usz j = 0; j < 7; ++j)
+				l.hiReg[j][i] = r.registers[m[8 + j]];
+
+			l.cpsr[i] = r.cpsr.value;
+		});
+	}
+
+	template<arm::Armulator::Version v, usz lanes>
+	void Lockstep<v, lanes>::scalar() {
+
+		sync();
+
+		u32 mask = activeLanes;
+
+		each([&](usz i) {
+
+			arm::Armulator &core = *cores[i];
+			const u8 *m = Registers::mapping[Mode::toId(core.r.cpsr.mode())] + 8;
+
+			stepThumb<v>(core.r, core.memory, m, cycles[i]);
+			++cycles[i];
+		});
+
+		converge(mask);
+	}
+
+	template<arm::Armulator::Version v, usz lanes>
+	usz Lockstep<v, lanes>::run(usz n) {
+
+		usz i{};
+
+		for (; i < n && activeLanes; ++i)
+			if (!lockstep())
+				scalar();
+
+		return i;
+	}
+
+	template<arm::Armulator::Version v, usz lanes>
+	bool Lockstep<v, lanes>::lockstep() {
+
+		auto &lo = l.loReg;
+		auto &hi = l.hiReg;
+		auto &cpsr = l.cpsr;
+
+		auto &r = *this;		//For the thumb/values.hpp macros (r.ir)
+
+		constexpr u32 nzMask = PSR::nMask | PSR::zMask;
+		constexpr u32 nzcMask = nzMask | PSR::cMask;
+
+		switch (Op5_11) {
+
+			//Shifts by intermediate; the shift is shared so only the data is per lane
+
+			case LSL: {
+
+				const u32 d = Rd3_0, s = Rs3_3, sh = i5_6;
+
+				if (sh == 0)
+					all([&](usz j) {
+						lo[d][j] = lo[s][j];
+						cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j]));
+					});
+
+				else all([&](usz j) {
+					const u32 a = lo[s][j], res = a << sh;
+					cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | ((a >> (32 - sh) & 1) << 29));
+					lo[d][j] = res;
+				});
+
+				break;
+			}
+
+			case LSR: {
+
+				const u32 d = Rd3_0, s = Rs3_3, sh = i5_6 ? i5_6 : 32;
+
+				all([&](usz j) {
+					const u32 a = lo[s][j], res = sh == 32 ? 0 : a >> sh;
+					cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | ((a >> (sh - 1) & 1) << 29));
+					lo[d][j] = res;
+				});
+
+				break;
+			}
+
+			case ASR: {
+
+				const u32 d = Rd3_0, s = Rs3_3, sh = i5_6 ? i5_6 : 32;
+
+				all([&](usz j) {
+					const u32 a = lo[s][j], res = u32(i32(a) >> (sh == 32 ? 31 : sh));
+					cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | ((u32(i32(a) >> (sh - 1)) & 1) << 29));
+					lo[d][j] = res;
+				});
+
+				break;
+			}
+
+			//Intermediate ALU operations
+
+			case MOV: {
+				const u32 d = Rd3_8, i = i8_0;
+				all([&](usz j) { lo[d][j] = i; cpsr[j] = setFlags(cpsr[j], nzMask, nz(i)); });
+				break;
+			}
+
+			case CMP: {
+				const u32 d = Rd3_8, i = i8_0;
+				all([&](usz j) { cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(lo[d][j], i, lo[d][j] - i)); });
+				break;
+			}
+
+			case ADD: {
+
+				const u32 d = Rd3_8, i = i8_0;
+
+				all([&](usz j) {
+					const u32 a = lo[d][j], res = a + i;
+					cpsr[j] = setFlags(cpsr[j], flagMask, addFlags(a, i, res));
+					lo[d][j] = res;
+				});
+
+				break;
+			}
+
+			case SUB: {
+
+				const u32 d = Rd3_8, i = i8_0;
+
+				all([&](usz j) {
+					const u32 a = lo[d][j], res = a - i;
+					cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, i, res));
+					lo[d][j] = res;
+				});
+
+				break;
+			}
+
+			case ADD_PC: {
+				const u32 d = Rd3_8, res = pc + i8_0_2;
+				all([&](usz j) { lo[d][j] = res; });
+				break;
+			}
+
+			case ADD_SP: {
+				const u32 d = Rd3_8, i = i8_0_2;
+				all([&](usz j) { lo[d][j] = hi[HiReg::sp][j] + i; });
+				break;
+			}
+
+			case INCR_SP: {
+
+				//PUSH shares the opcode
+
+				if (Op8_8 == PUSH || Op8_8 == PUSH_LR)
+					return false;
+
+				const u32 i = r.ir & 0x80 ? u32(-i32(i7_0_2)) : i7_0_2;
+				all([&](usz j) { hi[HiReg::sp][j] += i; });
+				break;
+			}
+
+			//Memory operations are per lane, since every lane has its own memory
+
+			case STRi: {
+				const u32 d = Rd3_0, s = Rs3_3, i = i5_6_2;
+				each([&](usz j) { memory(j).set(lo[s][j] + i, lo[d][j]); });
+				addCycles(1);
+				break;
+			}
+
+			case LDRi: {
+				const u32 d = Rd3_0, s = Rs3_3, i = i5_6_2;
+				each([&](usz j) { lo[d][j] = memory(j).template get<u32>(lo[s][j] + i); });
+				addCycles(2);
+				break;
+			}
+
+			case STRBi: {
+				const u32 d = Rd3_0, s = Rs3_3, i = i5_6;
+				each([&](usz j) { memory(j).set(lo[s][j] + i, u8(lo[d][j])); });
+				addCycles(1);
+				break;
+			}
+
+			case LDRBi: {
+				const u32 d = Rd3_0, s = Rs3_3, i = i5_6;
+				each([&](usz j) { lo[d][j] = memory(j).template get<u8>(lo[s][j] + i); });
+				addCycles(2);
+				break;
+			}
+
+			case STRHi: {
+				const u32 d = Rd3_0, s = Rs3_3, i = i5_6_1;
+				each([&](usz j) { memory(j).set(lo[s][j] + i, u16(lo[d][j])); });
+				addCycles(1);
+				break;
+			}
+
+			case LDRHi: {
+				const u32 d = Rd3_0, s = Rs3_3, i = i5_6_1;
+				each([&](usz j) { lo[d][j] = memory(j).template get<u16>(lo[s][j] + i); });
+				addCycles(2);
+				break;
+			}
+
+			case STR_SP: {
+				const u32 d = Rd3_8, i = i8_0_2;
+				each([&](usz j) { memory(j).set(hi[HiReg::sp][j] + i, lo[d][j]); });
+				break;
+			}
+
+			case LDR_SP: {
+				const u32 d = Rd3_8, i = i8_0_2;
+				each([&](usz j) { lo[d][j] = memory(j).template get<u32>(hi[HiReg::sp][j] + i); });
+				break;
+			}
+
+			case LDR_PC: {
+				const u32 d = Rd3_8, a = (pc & ~3) + i8_0_2;
+				each([&](usz j) { lo[d][j] = memory(j).template get<u32>(a); });
+				break;
+			}
+
+			case ADD_SUB:
+			case ST:
+			case LD: {
+
+				const u32 d = Rd3_0, s = Rs3_3, n = Rni3_6;
+
+				switch (Op7_9) {
+
+					case ADD_R:
+
+						all([&](usz j) {
+							const u32 a = lo[s][j], b = lo[n][j], res = a + b;
+							cpsr[j] = setFlags(cpsr[j], flagMask, addFlags(a, b, res));
+							lo[d][j] = res;
+						});
+
+						break;
+
+					case SUB_R:
+
+						all([&](usz j) {
+							const u32 a = lo[s][j], b = lo[n][j], res = a - b;
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, b, res));
+							lo[d][j] = res;
+						});
+
+						break;
+
+					case ADD_3B:
+
+						all([&](usz j) {
+							const u32 a = lo[s][j], res = a + n;
+							cpsr[j] = setFlags(cpsr[j], flagMask, addFlags(a, n, res));
+							lo[d][j] = res;
+						});
+
+						break;
+
+					case SUB_3B:
+
+						all([&](usz j) {
+							const u32 a = lo[s][j], res = a - n;
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, n, res));
+							lo[d][j] = res;
+						});
+
+						break;
+
+					case STR:
+						each([&](usz j) { memory(j).set(lo[s][j] + lo[n][j], lo[d][j]); });
+						break;
+
+					case STRH:
+						each([&](usz j) { memory(j).set(lo[s][j] + lo[n][j], u16(lo[d][j])); });
+						break;
+
+					case STRB:
+						each([&](usz j) { memory(j).set(lo[s][j] + lo[n][j], u8(lo[d][j])); });
+						break;
+
+					case LDSB:
+						each([&](usz j) { lo[d][j] = u32(i32(memory(j).template get<i8>(lo[s][j] + lo[n][j]))); });
+						break;
+
+					case LDR:
+						each([&](usz j) { lo[d][j] = memory(j).template get<u32>(lo[s][j] + lo[n][j]); });
+						break;
+
+					case LDRH:
+						each([&](usz j) { lo[d][j] = memory(j).template get<u16>(lo[s][j] + lo[n][j]); });
+						break;
+
+					case LDRB:
+						each([&](usz j) { lo[d][j] = memory(j).template get<u8>(lo[s][j] + lo[n][j]); });
+						break;
+
+					case LDSH:
+						each([&](usz j) { lo[d][j] = u32(i32(memory(j).template get<i16>(lo[s][j] + lo[n][j]))); });
+						break;
+
+					default:
+						return false;
+				}
+
+				break;
+			}
+
+			case ALU_HI_BX: {
+
+				const u32 d = Rd3_0, s = Rs3_3;
+
+				switch (Op10_6) {
+
+					case AND:
+						all([&](usz j) { lo[d][j] &= lo[s][j]; cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j])); });
+						break;
+
+					case EOR:
+						all([&](usz j) { lo[d][j] ^= lo[s][j]; cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j])); });
+						break;
+
+					case ORR:
+						all([&](usz j) { lo[d][j] |= lo[s][j]; cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j])); });
+						break;
+
+					case BIC:
+						all([&](usz j) { lo[d][j] &= ~lo[s][j]; cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j])); });
+						break;
+
+					case MVN:
+						all([&](usz j) { lo[d][j] = ~lo[s][j]; cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j])); });
+						break;
+
+					case TST:
+						all([&](usz j) { cpsr[j] = setFlags(cpsr[j], nzMask, nz(lo[d][j] & lo[s][j])); });
+						break;
+
+					case NEG:
+
+						all([&](usz j) {
+							const u32 b = lo[s][j], res = 0 - b;
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(0, b, res));
+							lo[d][j] = res;
+						});
+
+						break;
+
+					case CMP_R:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], b = lo[s][j];
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, b, a - b));
+						});
+
+						break;
+
+					case CMN:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], b = lo[s][j];
+							cpsr[j] = setFlags(cpsr[j], flagMask, addFlags(a, b, a + b));
+						});
+
+						break;
+
+					case ADC:
+
+						all([&](usz j) {
+							const u64 a = lo[d][j], b = lo[s][j], res = a + b + ((cpsr[j] >> 29) & 1);
+							const u32 res32 = u32(res);
+							cpsr[j] = setFlags(cpsr[j], flagMask,
+								nz(res32) | (u32(res >> 32) << 29) | (((~(u32(a) ^ u32(b)) & (u32(a) ^ res32)) >> 31) << 28)
+							);
+							lo[d][j] = res32;
+						});
+
+						break;
+
+					case SBC:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], b = lo[s][j], borrow = ~(cpsr[j] >> 29) & 1;
+							const u32 res = a - b - borrow;
+							cpsr[j] = setFlags(cpsr[j], flagMask,
+								nz(res) | (u32(u64(a) >= u64(b) + borrow) << 29) | ((((a ^ b) & (a ^ res)) >> 31) << 28)
+							);
+							lo[d][j] = res;
+						});
+
+						break;
+
+						//Shift by register; amounts >= 32 are valid, 0 leaves carry untouched
+
+					case LSL_R:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], sh = lo[s][j] & 0xFF;
+							const u32 res = sh >= 32 ? 0 : a << sh;
+							const u32 c = sh == 0 ? (cpsr[j] >> 29) & 1 : (sh > 32 ? 0 : (u32(u64(a) << sh >> 32) & 1));
+							cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | (c << 29));
+							lo[d][j] = res;
+						});
+
+						addCycles(1);
+						break;
+
+					case LSR_R:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], sh = lo[s][j] & 0xFF;
+							const u32 res = sh >= 32 ? 0 : a >> sh;
+							const u32 c = sh == 0 ? (cpsr[j] >> 29) & 1 : (sh > 32 ? 0 : u32(a >> (sh - 1)) & 1);
+							cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | (c << 29));
+							lo[d][j] = res;
+						});
+
+						addCycles(1);
+						break;
+
+					case ASR_R:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], sh = lo[s][j] & 0xFF;
+							const u32 res = u32(i32(a) >> (sh >= 32 ? 31 : sh));
+							const u32 c = sh == 0 ? (cpsr[j] >> 29) & 1 : u32(i32(a) >> (sh >= 32 ? 31 : sh - 1)) & 1;
+							cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | (c << 29));
+							lo[d][j] = res;
+						});
+
+						addCycles(1);
+						break;
+
+					case ROR:
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], sh = lo[s][j] & 0xFF, rot = sh & 31;
+							const u32 res = rot ? (a >> rot) | (a << (32 - rot)) : a;
+							const u32 c = sh == 0 ? (cpsr[j] >> 29) & 1 : res >> 31;
+							cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res) | (c << 29));
+							lo[d][j] = res;
+						});
+
+						addCycles(1);
+						break;
+
+						//Multiply timing depends on the multiplier so cycles are per lane (see stepThumb)
+
+					case MUL:
+
+						each([&](usz j) {
+
+							if constexpr ((v & 0xFF) <= arm::Armulator::VersionSpec::v4)
+								cycles[j] += arm::multiplyCycles(lo[d][j]);
+							else
+								cycles[j] += 3;
+						});
+
+						all([&](usz j) {
+
+							const u32 res = lo[d][j] * lo[s][j];
+
+							if constexpr ((v & 0xFF) <= arm::Armulator::VersionSpec::v4)
+								cpsr[j] = setFlags(cpsr[j], nzcMask, nz(res));
+							else
+								cpsr[j] = setFlags(cpsr[j], nzMask, nz(res));
+
+							lo[d][j] = res;
+						});
+
+						break;
+
+						//High registers; pc is shared and handled through the scalar path
+
+					case ADD_LO_HI:
+
+						if (s == 7)
+							return false;
+
+						all([&](usz j) { lo[d][j] += hi[s][j]; });
+						break;
+
+					case ADD_HI_LO:
+
+						if (d == 7)
+							return false;
+
+						all([&](usz j) { hi[d][j] += lo[s][j]; });
+						break;
+
+					case ADD_HI_HI:
+
+						if (d == 7 || s == 7)
+							return false;
+
+						all([&](usz j) { hi[d][j] += hi[s][j]; });
+						break;
+
+					case CMP_LO_HI:
+
+						if (s == 7)
+							return false;
+
+						all([&](usz j) {
+							const u32 a = lo[d][j], b = hi[s][j];
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, b, a - b));
+						});
+
+						break;
+
+					case CMP_HI_LO:
+
+						if (d == 7)
+							return false;
+
+						all([&](usz j) {
+							const u32 a = hi[d][j], b = lo[s][j];
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, b, a - b));
+						});
+
+						break;
+
+					case CMP_HI_HI:
+
+						if (d == 7 || s == 7)
+							return false;
+
+						all([&](usz j) {
+							const u32 a = hi[d][j], b = hi[s][j];
+							cpsr[j] = setFlags(cpsr[j], flagMask, subFlags(a, b, a - b));
+						});
+
+						break;
+
+					case MOV_LO_HI:
+
+						if (s == 7)
+							return false;
+
+						all([&](usz j) { lo[d][j] = hi[s][j]; });
+						break;
+
+					case MOV_HI_LO:
+
+						if (d == 7)
+							return false;
+
+						all([&](usz j) { hi[d][j] = lo[s][j]; });
+						break;
+
+					case MOV_HI_HI:
+
+						if (d == 7 || s == 7)
+							return false;
+
+						all([&](usz j) { hi[d][j] = hi[s][j]; });
+						break;
+
+					default:
+						return false;
+				}
+
+				break;
+			}
+
+			//Branches; if the lanes disagree on a conditional branch they are stepped separately and converged
+
+			case B:
+				pc += s12;
+				addCycles(3);
+				refill();
+				return true;
+
+			case B0:
+			case B1: {
+
+				const u32 op = Op8_8;
+
+				if (op == SWI)
+					return false;
+
+				u32 taken{};
+
+				each([&](usz j) {
+					PSR psr{ cpsr[j] };
+					taken |= u32(arm::doCondition(arm::cond::Condition(op & 0xF), psr)) << j;
+				});
+
+				if (taken && taken != activeLanes)
+					return false;
+
+				if (taken) {
+					pc += u32(i8(i8_0)) << 1;
+					addCycles(3);
+					refill();
+					return true;
+				}
+
+				break;
+			}
+
+			default:
+				return false;
+		}
+
+		addCycles(1);
+		fetch();
+		return true;
+	}
+
+}
\ No newline at end of file
@@ -36,7 +36,7 @@ namespace arm::thumb {
 
 		TI v;
 
-		RegOp0b(TI Rd, TI Rs, TI op): v(Rd | (Rs << 3) | (op << 6)) {}
+		constexpr RegOp0b(TI Rd, TI Rs, TI op): v(Rd | (Rs << 3) | (op << 6)) {}
 
 		__forceinline u32 Rd() const { return v & 7; }			//Destination register
 		__forceinline u32 Rs() const { return (v >> 3) & 7; }	//Source register
@@ -57,7 +57,7 @@ namespace arm::thumb {
 
 		TI v;
 
-		RegOp3b(TI Rd, TI Rs, TI Rni, TI op): v(Rd | (Rs << 3) | (Rni << 6) | (op << 9)) {}
+		constexpr RegOp3b(TI Rd, TI Rs, TI Rni, TI op): v(Rd | (Rs << 3) | (Rni << 6) | (op << 9)) {}
 
 		__forceinline u32 Rd() const { return v & 7; }			//Destination register
 		__forceinline u32 Rs() const { return (v >> 3) & 7; }	//Source register
@@ -77,7 +77,7 @@ namespace arm::thumb {
 
 		TI v;
 
-		RegOp5b(TI Rd, TI Rs, TI i, TI op): v(Rd | (Rs << 3) | (i << 6) | (op << 11)) {}
+		constexpr RegOp5b(TI Rd, TI Rs, TI i, TI op): v(Rd | (Rs << 3) | (i << 6) | (op << 11)) {}
 
 		__forceinline u32 Rd() const { return v & 7; }			//Destination register
 		__forceinline u32 Rs() const { return (v >> 3) & 7; }	//Source register
@@ -114,7 +114,7 @@ namespace arm::thumb {
 
 		TI v;
 
-		RegOp8b(TI i, TI Rd, TI op): v(i | (Rd << 8) | (op << 11)) {}
+		constexpr RegOp8b(TI i, TI Rd, TI op): v(i | (Rd << 8) | (op << 11)) {}
 
 		__forceinline u32 i() const { return v & 0xFF; }		//Intermediate
 		__forceinline u32 Rd() const { return (v >> 8) & 7; }	//Destination register
@@ -4,20 +4,25 @@
 #include "arm/helper.hpp"
 #include "arm/thumb/values.hpp"
 #include "arm/thumb/debug.hpp"
+#include "arm/thumb/fusion.hpp"
 #include "emu/stack.hpp"
 
 //Step through a thumb instruction
 //Where m is the mapping of high registers (type mapping + 8) so m[HiReg] matches the register id it should fetch from
 //Normal instructions take 1 cycle
+//Cycles is usz for exact timing or arm::NoCycles to drop the per instruction timings
+//Memory is the armulator's memory or a Probe around it (see instrumentation.hpp)
+//Returns true if the pipeline was refilled (branch or exception); this ends a block
 
 namespace arm::thumb {
 
 	template<
-		arm::Armulator::Version v, bool ascendingStack = false, bool emptyStack = false
+		arm::Armulator::Version v, bool ascendingStack = false, bool emptyStack = false,
+		typename Cycles = usz, typename Memory = arm::Armulator::Memory
 	>
-	_inline_ void stepThumb(arm::Registers &r, arm::Armulator::Memory &memory, const u8 *&m, usz &cycles) {
+	_inline_ bool stepThumb(arm::Registers &r, Memory &memory, const u8 *&m, Cycles &cycles) {
 
-		using Stack = arm::Armulator::Stack;
+		using Stack = emu::Stack<Memory, u32>;
 
 		switch (Op5_11 /* fetch first 5 bits of opcode */) {
 
@@ -109,22 +114,52 @@ namespace arm::thumb {
 				r.loReg[Rd3_8] = r.registers[m[HiReg::sp]] + i8_0_2;
 				break;
 
+				//ADD SP, #i shares its 5-bit opcode with PUSH
+				//Push and pop instructions (full descending stack)
+				//The registers are stored in ascending order with lr furthest from the top
+
 			case INCR_SP:
-				r.registers[m[HiReg::sp]] += r.ir & 0x80 ? u32(-i32(i7_0_2)) : i7_0_2;
+
+				switch (Op8_8) {
+
+					case PUSH_LR:
+						Stack::push(memory, r.registers[m[HiReg::sp]], r.registers[m[HiReg::lr]] | 1);
+						++cycles;
+
+					case PUSH:
+						arm::miaNeg<u32, true>(memory, cycles, r.registers[m[HiReg::sp]], r);
+						break;
+
+					default:
+						r.registers[m[HiReg::sp]] += r.ir & 0x80 ? u32(-i32(i7_0_2)) : i7_0_2;
+				}
+
 				break;
 
 				//Load/store multiple
 				//LDMIA takes 2 + n cycles
 				//STMIA takes 1 + n cycles
+				//The base is written back, unless LDMIA loads it
 
-			case STMIA:
-				arm::miaPos<u32, true>(memory, cycles, r.loReg[Rd3_8], r);
+			case STMIA: {
+				u32 base = r.loReg[Rd3_8];
+				arm::miaPos<u32, true>(memory, cycles, base, r);
+				r.loReg[Rd3_8] = base;
 				break;
+			}
+
+			case LDMIA: {
 
-			case LDMIA:
 				++cycles;
-				arm::miaNeg<u32, false>(memory, cycles, r.loReg[Rd3_8], r);
+
+				u32 base = r.loReg[Rd3_8];
+				arm::miaPos<u32, false>(memory, cycles, base, r);
+
+				if (!(r.ir & (1 << Rd3_8)))
+					r.loReg[Rd3_8] = base;
+
 				break;
+			}
 
 				//Unconditional (thumb) branch
 				//Interpret 11-bit 2's complement as u32
@@ -134,7 +169,7 @@ namespace arm::thumb {
 			case B:
 				r.pc += s12;
 				arm::branch<true, false>(r, memory, cycles, m);
-				return;
+				return true;
 
 				//Conditional (thumb) branch
 				//Assembler takes into account prefetch
@@ -165,38 +200,31 @@ namespace arm::thumb {
 						if (arm::doCondition(arm::cond::Condition(Op8_8 & 0xF), r.cpsr)) {
 							r.pc += u32(i8(i8_0)) << 1;
 							arm::branch<true, false>(r, memory, cycles, m);
-							return;
+							return true;
 						}
 
 						break;
 
 					case SWI:
 						arm::exception<true, arm::Exception::SWI>(r, memory, cycles, m);
-						return;
-
-						//Push and pop instructions
-						//Assuming r0 is located closest to the top and lr is located furthest from the top
-					case PUSH_LR:
-
-						Stack::push(memory, r.registers[m[HiReg::sp]], r.registers[m[HiReg::lr]] | 1);
-						++cycles;
-
-					case PUSH:
-
-						arm::miaNeg<u32, true>(memory, cycles, r.loReg[Rd3_8], r);
-						break;
+						return true;
 
+						//Pop; r0 is located closest to the top and pc furthest from the top
 					case POP_PC:
 						++cycles;
 
 					case POP:
 
-						arm::miaPos<u32, false>(memory, cycles, r.loReg[Rd3_8], r);
+						arm::miaPos<u32, false>(memory, cycles, r.registers[m[HiReg::sp]], r);
 
 						if (r.ir & 0x100) {
 							Stack::pop(memory, r.registers[m[HiReg::sp]], r.pc);
+
+							if constexpr ((v & 0xFF) < arm::Armulator::VersionSpec::v5)
+								r.pc &= ~1;				//No interworking; bit 0 is ignored
+
 							arm::branch<true, (v & 0xFF) >= arm::Armulator::VersionSpec::v5>(r, memory, cycles, m);
-							return;
+							return true;
 						}
 
 						break;
@@ -205,7 +233,7 @@ namespace arm::thumb {
 
 						if constexpr ((v & 0xFF) >= arm::Armulator::VersionSpec::v5) {
 							arm::exception<true, arm::Exception::PREFETCH_ABORT>(r, memory, cycles, m);
-							return;
+							return true;
 						}
 
 					default:
@@ -220,10 +248,10 @@ namespace arm::thumb {
 				//Takes 4 cycles
 			case BLL:
 				++cycles;
-				r.registers[m[HiReg::lr]] = (r.pc - 2) | 1;		//Next instruction into LR
+				r.registers[m[HiReg::lr]] = r.pc | 1;			//Next instruction (after both halves) into LR
 				r.pc += s23;
 				arm::branch<true, false>(r, memory, cycles, m);
-				return;
+				return true;
 
 				//Long branch with link
 				//Fetch nir and construct 23-bit two's complement and jump to it
@@ -235,11 +263,11 @@ namespace arm::thumb {
 
 					++cycles;
 
-					r.registers[m[HiReg::lr]] = (r.pc - 2) | 1;		//Next instruction into LR
+					r.registers[m[HiReg::lr]] = r.pc | 1;			//Next instruction (after both halves) into LR
 					r.pc += s23;
 
 					arm::branch<true, true, true>(r, memory, cycles, m);
-					return;
+					return true;
 
 				} else
 					goto undef;
@@ -338,11 +366,11 @@ namespace arm::thumb {
 						break;
 
 					case ADC:
-						emu::addTo(r.cpsr, r.loReg[Rd3_0], r.loReg[Rs3_3] + r.cpsr.carry());
+						arm::adcTo(r.cpsr, r.loReg[Rd3_0], r.loReg[Rs3_3]);
 						break;
 
 					case SBC:
-						emu::subFrom(r.cpsr, r.loReg[Rd3_0], r.loReg[Rs3_3] + r.cpsr.carry());
+						arm::sbcFrom(r.cpsr, r.loReg[Rd3_0], r.loReg[Rs3_3]);
 						break;
 
 					case ROR:
@@ -381,14 +409,8 @@ namespace arm::thumb {
 
 							r.cpsr.value &= ~r.cpsr.cMask;
 
-							if (oic::Math::abs(i32(r.loReg[Rd3_0])) < (1 << 8))
-								++cycles;
-							else if (oic::Math::abs(i32(r.loReg[Rd3_0])) < (1 << 16))
-								cycles += 2;
-							else if (oic::Math::abs(i32(r.loReg[Rd3_0])) < (1 << 24))
-								cycles += 3;
-							else
-								cycles += 4;
+							if constexpr (arm::countsCycles<Cycles>)
+								cycles += arm::multiplyCycles(r.loReg[Rd3_0]);
 
 						} else
 							cycles += 3;
@@ -444,7 +466,7 @@ namespace arm::thumb {
 
 						if (Rd3_0 == HiReg::pc) {
 							arm::branch<true, (v & 0xFF) >= arm::Armulator::VersionSpec::v5>(r, memory, cycles, m);
-							return;
+							return true;
 						}
 
 						break;
@@ -455,12 +477,12 @@ namespace arm::thumb {
 					case BX_LO:
 						r.pc = r.loReg[Rs3_3];
 						arm::branch<true, true>(r, memory, cycles, m);
-						return;
+						return true;
 
 					case BX_HI:
 						r.pc = r.registers[m[Rs3_3]];
 						arm::branch<true, true>(r, memory, cycles, m);
-						return;
+						return true;
 
 					default:
 						goto undef;
@@ -472,17 +494,103 @@ namespace arm::thumb {
 			default:
 				goto undef;
 
-				//TODO: Aborts; prefetch and data abort
-				//TODO: USR mode should enable bios protection, otherwise disable it
+				//Aborts (and protecting e.g. the BIOS from USR mode) are handled around the step by the protection unit (cp15.hpp)
 
 		}
 
 		arm::fetchNext<true>(r, memory);
-		return;
+		return false;
 
 	undef:
 		arm::exception<true, arm::Exception::UND>(r, memory, cycles, m);
+		return true;
+	}
+
+	//ADD as the second instruction of a pair; ADD Rd, #i / ADD Rd, Rs, Rn / ADD Rd, Rs, #i
+
+	_inline_ void addPair(arm::Registers &r) {
+
+		if (Op5_11 == ADD)
+			emu::addTo(r.cpsr, r.loReg[Rd3_8], i8_0);
 
+		else if (Op7_9 == ADD_R)
+			r.loReg[Rd3_0] = emu::add(r.cpsr, r.loReg[Rs3_3], r.loReg[Rni3_6]);
+
+		else r.loReg[Rd3_0] = emu::add(r.cpsr, r.loReg[Rs3_3], Rni3_6);
+	}
+
+	//Step through a fused pair (see fusion.hpp); ir and nir hold the two instructions
+	//The first one runs, then the pipeline moves on to the second, like two calls to stepThumb would;
+	//the caller counts the 1 cycle of both instructions
+	//Returns true if the pipeline was refilled (taken branch)
+
+	template<arm::Armulator::Version v, typename Cycles = usz, typename Memory = arm::Armulator::Memory>
+	_inline_ bool stepPair(arm::Registers &r, Memory &memory, const u8 *&m, Cycles &cycles, Pair pair) {
+
+		using Stack = emu::Stack<Memory, u32>;
+
+		switch (pair) {
+
+			case Pair::CMP_BCC:
+
+				if (Op5_11 == CMP)
+					emu::sub(r.cpsr, r.loReg[Rd3_8], i8_0);
+				else
+					emu::sub(r.cpsr, r.loReg[Rd3_0], r.loReg[Rs3_3]);
+
+				arm::fetchNext<true>(r, memory);
+
+				if (arm::doCondition(arm::cond::Condition(Op8_8 & 0xF), r.cpsr)) {
+					r.pc += u32(i8(i8_0)) << 1;
+					arm::branch<true, false>(r, memory, cycles, m);
+					return true;
+				}
+
+				break;
+
+				//MOV only sets N and Z, which ADD overwrites
+
+			case Pair::MOV_ADD:
+				r.loReg[Rd3_8] = i8_0;
+				arm::fetchNext<true>(r, memory);
+				addPair(r);
+				break;
+
+			case Pair::LDR_ADD:
+
+				if (Op5_11 == LDRi) {
+					cycles += 2;
+					emu::ldr(memory, r.loReg[Rd3_0], r.loReg[Rs3_3], i5_6_2);
+				} else
+					emu::ldr(memory, r.loReg[Rd3_8], r.registers[m[HiReg::sp]], i8_0_2);
+
+				arm::fetchNext<true>(r, memory);
+				addPair(r);
+				break;
+
+				//ASR #n (n != 0) sets N, Z and C; LSL doesn't touch V, so its flags are all overwritten
+
+			case Pair::LSL_ASR: {
+				const u32 shifted = r.loReg[Rs3_3] << i5_6;
+				arm::fetchNext<true>(r, memory);
+				r.loReg[Rd3_0] = emu::asr(r.cpsr, shifted, i5_6);
+				break;
+			}
+
+			case Pair::PUSH_SUB_SP:
+				Stack::push(memory, r.registers[m[HiReg::sp]], r.registers[m[HiReg::lr]] | 1);
+				++cycles;
+				arm::miaNeg<u32, true>(memory, cycles, r.registers[m[HiReg::sp]], r);
+				arm::fetchNext<true>(r, memory);
+				r.registers[m[HiReg::sp]] -= i7_0_2;
+				break;
+
+			default:
+				break;
+		}
+
+		arm::fetchNext<true>(r, memory);
+		return false;
 	}
 
 }
\ No newline at end of file
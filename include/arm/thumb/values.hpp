@@ -29,7 +29,7 @@
 #define i8_0_1 ((r.ir & 0xFF) << 1)
 #define i8_0_2 ((r.ir & 0xFF) << 2)
 #define i7_0_2 ((r.ir & 0x7F) << 2)
-#define s12 (((r.ir << 1) & 0xFFE) | (r.ir & 0x400 * (0xFFFFF000 / 0x400)))
-#define s23 ((((r.ir << 1) & 0xFFE) | ((r.nir << 12) & 0x7FF000)) | (r.nir & 0x400 * (0xFF800000 / 0x400)))
+#define s12 (((r.ir << 1) & 0xFFE) | ((r.ir & 0x400) * (0xFFFFF000 / 0x400)))
+#define s23 ((((r.ir << 1) & 0xFFE) | ((r.nir << 12) & 0x7FF000)) | ((r.nir & 0x400) * (0xFF800000 / 0x400)))
 #define Rd3_8 ((r.ir >> 8) & 7)
 #define Op8_8 (r.ir >> 8)
\ No newline at end of file
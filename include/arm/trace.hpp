@@ -0,0 +1,457 @@
+#pragma once
+#include "instrumentation.hpp"
+#include "spsc_queue.hpp"
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+namespace arm {
+
+	//Binary execution trace; a replacement for PRINT_INSTRUCTION/PRINT_REGISTERS
+	//The run loop records into the calling thread's recorder through the Tracer policy (see instrumentation.hpp).
+	//Events go through a lock-free ring buffer to a background thread that encodes and writes them to the file,
+	//so the emulation thread never formats or does IO itself. tools/trace_decode.cpp turns a trace into text.
+	//
+	//File layout: "ATRC", u32 version, followed by records that start with a tag (kind | arg << 2):
+	//	INSTRUCTION (arg = thumb): pc delta (zigzag varint), opcode (varint; thumb: ir | nir << 16)
+	//	READ/WRITE (arg = size): address delta (zigzag varint), value (varint)
+	//	REGISTER (arg = register, 16 = cpsr): value (varint)
+
+	struct TraceEvent {
+
+		enum Kind : u8 {
+			INSTRUCTION,
+			READ,
+			WRITE,
+			REGISTER
+		};
+
+		Kind kind;
+		u8 arg;
+		u32 address;		//Address of the instruction or access, unused for REGISTER
+		u32 value;			//Opcode, value that was accessed or register value
+	};
+
+	//Delta + varint coding of events
+
+	struct TraceCodec {
+
+		static constexpr u32 magic = 0x43525441;		//ATRC
+		static constexpr u32 version = 1;
+		static constexpr usz headerSize = 8;
+
+		static constexpr u8 cpsr = 16;					//REGISTER arg for the cpsr
+
+		static __forceinline void header(List<u8> &out) {
+			put32(out, magic);
+			put32(out, version);
+		}
+
+		__forceinline void encode(List<u8> &out, const TraceEvent &e) {
+
+			out.push_back(u8(e.kind | (e.arg << 2)));
+
+			switch (e.kind) {
+
+				case TraceEvent::INSTRUCTION:
+					varint(out, zigzag(e.address - lastPc));
+					lastPc = e.address;
+					break;
+
+				case TraceEvent::READ:
+				case TraceEvent::WRITE:
+					varint(out, zigzag(e.address - lastAddress));
+					lastAddress = e.address;
+					break;
+
+				case TraceEvent::REGISTER:
+					break;
+			}
+
+			varint(out, e.value);
+		}
+
+		//Returns false at the end of the data or if the data is corrupt
+		bool decode(const u8 *&ptr, const u8 *end, TraceEvent &e) {
+
+			if (ptr >= end)
+				return false;
+
+			const u8 tag = *ptr++;
+
+			e.kind = TraceEvent::Kind(tag & 3);
+			e.arg = tag >> 2;
+
+			u32 v;
+
+			switch (e.kind) {
+
+				case TraceEvent::INSTRUCTION:
+
+					if (!read(ptr, end, v))
+						return false;
+
+					e.address = lastPc += unzigzag(v);
+					break;
+
+				case TraceEvent::READ:
+				case TraceEvent::WRITE:
+
+					if (!read(ptr, end, v))
+						return false;
+
+					e.address = lastAddress += unzigzag(v);
+					break;
+
+				case TraceEvent::REGISTER:
+					e.address = 0;
+					break;
+			}
+
+			return read(ptr, end, e.value);
+		}
+
+		static bool validHeader(const u8 *ptr, usz size) {
+			return size >= headerSize && get32(ptr) == magic && get32(ptr + 4) == version;
+		}
+
+	private:
+
+		u32 lastPc{}, lastAddress{};
+
+		static __forceinline u32 zigzag(u32 v) { return (v << 1) ^ u32(i32(v) >> 31); }
+		static __forceinline u32 unzigzag(u32 v) { return (v >> 1) ^ u32(-i32(v & 1)); }
+
+		static __forceinline void varint(List<u8> &out, u32 v) {
+
+			while (v >= 0x80) {
+				out.push_back(u8(v | 0x80));
+				v >>= 7;
+			}
+
+			out.push_back(u8(v));
+		}
+
+		static __forceinline bool read(const u8 *&ptr, const u8 *end, u32 &v) {
+
+			v = 0;
+
+			for (u32 shift = 0; shift < 35 && ptr < end; shift += 7) {
+
+				const u8 b = *ptr++;
+				v |= u32(b & 0x7F) << shift;
+
+				if (!(b & 0x80))
+					return true;
+			}
+
+			return false;
+		}
+
+		static __forceinline void put32(List<u8> &out, u32 v) {
+			for (usz i = 0; i < 4; ++i)
+				out.push_back(u8(v >> (i * 8)));
+		}
+
+		static __forceinline u32 get32(const u8 *ptr) {
+			return u32(ptr[0]) | (u32(ptr[1]) << 8) | (u32(ptr[2]) << 16) | (u32(ptr[3]) << 24);
+		}
+
+	};
+
+	//Output file; mapped into memory and grown by doubling, truncated to the written size on close
+	//Falls back to buffered writes where mmap isn't available
+
+	struct TraceFile {
+
+		TraceFile() = default;
+		~TraceFile() { close(); }
+
+		TraceFile(const TraceFile&) = delete;
+		TraceFile &operator=(const TraceFile&) = delete;
+
+		bool open(const c8 *path);
+		bool append(const u8 *data, usz size);
+		void close();
+
+	private:
+
+		#ifndef _WIN32
+
+			int fd = -1;
+			u8 *map{};
+			usz capacity{};
+
+			bool grow(usz needed);
+
+		#else
+			std::FILE *file{};
+		#endif
+
+		usz size{};
+
+	};
+
+	//Records the events of one thread and writes them out on a background thread
+
+	template<usz bufferSize = (1 << 16)>
+	struct TraceRecorder {
+
+		TraceRecorder() = default;
+		~TraceRecorder() { stop(); }
+
+		TraceRecorder(const TraceRecorder&) = delete;
+		TraceRecorder &operator=(const TraceRecorder&) = delete;
+
+		//Open the file and start the writer; returns false if the file can't be created
+		bool start(const c8 *path);
+
+		//Write out everything that's left and close the file
+		void stop();
+
+		//Record events of the calling thread into this recorder (until detach)
+		__forceinline void attach() { current = this; }
+		static __forceinline void detach() { current = nullptr; }
+
+		//Blocks if the writer falls behind; a trace doesn't drop events
+		__forceinline void record(const TraceEvent &e) {
+			while (!queue.push(e))
+				std::this_thread::yield();
+		}
+
+		static inline thread_local TraceRecorder *current{};
+
+		u32 shadow[TraceCodec::cpsr + 1]{};		//Last recorded registers, for register deltas
+
+	private:
+
+		SpscQueue<TraceEvent, bufferSize> queue;
+		TraceFile file;
+		std::thread writer;
+		std::atomic<bool> running{};
+
+		void write();
+
+	};
+
+	//Instrumentation policy that records into TraceRecorder<>::current
+	//registers: record the registers that changed before every instruction
+	//memory: record data accesses
+
+	template<bool registers = false, bool memory = false, usz bufferSize = (1 << 16)>
+	struct Tracer : NoHooks {
+
+		using Recorder = TraceRecorder<bufferSize>;
+
+		static __forceinline void onFetch(const Registers &r, u32 address, u32 ir) {
+
+			Recorder *rec = Recorder::current;
+
+			if (!rec)
+				return;
+
+			if constexpr (registers) {
+
+				const u8 *m = Registers::mapping[Mode::toId(r.cpsr.mode())];
+
+				for (u8 i = 0; i < Register::pc; ++i)
+					if (rec->shadow[i] != r.registers[m[i]])
+						rec->record({ TraceEvent::REGISTER, i, 0, rec->shadow[i] = r.registers[m[i]] });
+
+				if (rec->shadow[TraceCodec::cpsr] != r.cpsr.value)
+					rec->record({
+						TraceEvent::REGISTER, TraceCodec::cpsr, 0, rec->shadow[TraceCodec::cpsr] = r.cpsr.value
+					});
+			}
+
+			const bool thumb = r.cpsr.thumb();
+			rec->record({ TraceEvent::INSTRUCTION, u8(thumb), address, thumb ? ir | (r.nir << 16) : ir });
+		}
+
+		static __forceinline void onRead(u32 address, u32 size, u32 value) {
+			if constexpr (memory)
+				if (Recorder *rec = Recorder::current)
+					rec->record({ TraceEvent::READ, u8(size), address, value });
+		}
+
+		static __forceinline void onWrite(u32 address, u32 size, u32 value) {
+			if constexpr (memory)
+				if (Recorder *rec = Recorder::current)
+					rec->record({ TraceEvent::WRITE, u8(size), address, value });
+		}
+
+	};
+
+	//TraceFile
+
+	#ifndef _WIN32
+
+		inline bool TraceFile::open(const c8 *path) {
+
+			close();
+
+			fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+			if (fd < 0)
+				return false;
+
+			size = 0;
+			return grow(1 << 20);
+		}
+
+		inline bool TraceFile::grow(usz needed) {
+
+			usz next = capacity ? capacity : needed;
+
+			while (next < needed)
+				next <<= 1;
+
+			if (map)
+				munmap(map, capacity);
+
+			map = nullptr;
+			capacity = 0;
+
+			if (ftruncate(fd, off_t(next)))
+				return false;
+
+			void *ptr = mmap(nullptr, next, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+			if (ptr == MAP_FAILED)
+				return false;
+
+			map = (u8*) ptr;
+			capacity = next;
+			return true;
+		}
+
+		inline bool TraceFile::append(const u8 *data, usz n) {
+
+			if (size + n > capacity && !grow(size + n))
+				return false;
+
+			std::memcpy(map + size, data, n);
+			size += n;
+			return true;
+		}
+
+		inline void TraceFile::close() {
+
+			if (fd < 0)
+				return;
+
+			if (map)
+				munmap(map, capacity);
+
+			if (ftruncate(fd, off_t(size))) {}		//Only trailing zeroes stay behind if it fails
+
+			::close(fd);
+
+			fd = -1;
+			map = nullptr;
+			capacity = size = 0;
+		}
+
+	#else
+
+		inline bool TraceFile::open(const c8 *path) {
+			close();
+			file = std::fopen(path, "wb");
+			size = 0;
+			return file;
+		}
+
+		inline bool TraceFile::append(const u8 *data, usz n) {
+			size += n;
+			return file && std::fwrite(data, 1, n, file) == n;
+		}
+
+		inline void TraceFile::close() {
+
+			if (file)
+				std::fclose(file);
+
+			file = nullptr;
+		}
+
+	#endif
+
+	//TraceRecorder
+
+	template<usz bufferSize>
+	bool TraceRecorder<bufferSize>::start(const c8 *path) {
+
+		stop();
+
+		if (!file.open(path))
+			return false;
+
+		for (u32 &s : shadow)
+			s = 0;
+
+		running.store(true, std::memory_order_release);
+		writer = std::thread([this]() { write(); });
+		return true;
+	}
+
+	template<usz bufferSize>
+	void TraceRecorder<bufferSize>::stop() {
+
+		if (!writer.joinable())
+			return;
+
+		running.store(false, std::memory_order_release);
+		writer.join();
+		file.close();
+	}
+
+	//Encodes in chunks, so the file is only touched every so often
+
+	template<usz bufferSize>
+	void TraceRecorder<bufferSize>::write() {
+
+		static constexpr usz chunk = 1 << 16;
+
+		TraceCodec codec;
+		List<u8> out;
+		out.reserve(chunk + 64);
+
+		TraceCodec::header(out);
+
+		TraceEvent e;
+
+		while (true) {
+
+			//Check running before draining, so nothing recorded before stop is lost
+
+			const bool last = !running.load(std::memory_order_acquire);
+			bool any = false;
+
+			while (queue.pop(e)) {
+
+				codec.encode(out, e);
+				any = true;
+
+				if (out.size() >= chunk) {
+					file.append(out.data(), out.size());
+					out.clear();
+				}
+			}
+
+			if (last)
+				break;
+
+			if (!any)
+				std::this_thread::yield();
+		}
+
+		file.append(out.data(), out.size());
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,811 @@
+#pragma once
+#include "registers.hpp"
+#include <cfenv>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+#endif
+
+namespace arm {
+
+	//VFPv2 coprocessor; CP10 for single and CP11 for double precision
+	//s0-s31 and d0-d15 share the register file like on the hardware (d0 = s1:s0).
+	//Arithmetic runs on the host's floating point (scalar SSE on x86-64) in the FPSCR rounding mode,
+	//the host exception flags become the FPSCR cumulative flags. NaN propagation, flush-to-zero and default NaN follow the VFP.
+	//Short vectors (FPSCR LEN/STRIDE) iterate through the register banks; contiguous ones run on packed SSE.
+	//Exceptions with their trap enabled bounce to the undefined instruction vector (like VFP9 does for its support code);
+	//FPEXC.EX is set and nothing is written.
+	//Tininess is detected after rounding (the host's), the VFP detects it before rounding.
+
+	struct Vfp {
+
+		union {
+			u32 raw[32]{};
+			f32 s[32];
+			f64 d[16];
+		};
+
+		u32 fpscr{};
+		u32 fpexc{};			//Disabled until the guest sets EN
+
+		static constexpr u32 fpsid = 0x41011090;		//VFP9-S
+
+		//FPSCR
+
+		static constexpr u32
+			IOC = 1 << 0, DZC = 1 << 1, OFC = 1 << 2, UFC = 1 << 3, IXC = 1 << 4, IDC = 1 << 7,		//Cumulative flags
+			trapShift = 8,																			//Trap enables are the flags << 8
+			FZ = 1 << 24, DN = 1 << 25,
+			fpscrMask = 0xF3F79F9F;
+
+		//FPEXC
+
+		static constexpr u32 EN = 1 << 30, EX = 1u << 31;
+
+		enum Rounding : u8 {
+			NEAREST, PLUS_INFINITY, MINUS_INFINITY, ZERO
+		};
+
+		__forceinline bool enabled() const { return fpexc & EN; }
+		__forceinline u32 length() const { return ((fpscr >> 16) & 7) + 1; }
+		__forceinline u32 stride() const { return (fpscr >> 20) & 3 ? 2 : 1; }
+		__forceinline Rounding rounding() const { return Rounding((fpscr >> 22) & 3); }
+
+		//If the instruction is in the CP10/CP11 space (LDC/STC/MCRR/MRRC, CDP/MCR/MRC)
+		static __forceinline bool owns(u32 ir) {
+			return (ir & 0xE00) == 0xA00 && (((ir >> 25) & 7) == 6 || ((ir >> 24) & 0xF) == 0xE);
+		}
+
+		//Run the VFP instruction in ir; returns false if it's undefined (or bounced)
+		template<typename Memory, typename Cycles>
+		bool step(Registers &r, Memory &mem, const u8 *m, Cycles &cycles);
+
+	private:
+
+		//Transfers
+
+		template<typename Memory, typename Cycles>
+		bool loadStore(Registers &r, Memory &mem, const u8 *m, Cycles &cycles);
+
+		bool transfer(Registers &r, const u8 *m);
+		bool transferPair(Registers &r, const u8 *m);
+
+		//Data processing
+
+		template<typename T, typename Cycles>
+		bool dataProc(u32 ir, Cycles &cycles);
+
+		template<typename T>
+		bool extension(u32 ir, u32 op, u32 &flags, u32 &nzcv);
+
+		template<typename T>
+		__forceinline T *file() {
+			if constexpr (std::is_same_v<T, f32>) return s;
+			else return d;
+		}
+
+		//Host floating point environment around an instruction
+
+		struct Host {
+
+			int saved;
+
+			Host(Rounding mode) {
+
+				static constexpr int modes[] = { FE_TONEAREST, FE_UPWARD, FE_DOWNWARD, FE_TOWARDZERO };
+
+				saved = mode == NEAREST ? -1 : std::fegetround();
+
+				if (saved != -1)
+					std::fesetround(modes[mode]);
+
+				std::feclearexcept(FE_ALL_EXCEPT);
+			}
+
+			u32 flags() const {
+
+				const int e = std::fetestexcept(FE_ALL_EXCEPT);
+
+				return (e & FE_INVALID ? IOC : 0) | (e & FE_DIVBYZERO ? DZC : 0) | (e & FE_OVERFLOW ? OFC : 0) |
+					(e & FE_UNDERFLOW ? UFC : 0) | (e & FE_INEXACT ? IXC : 0);
+			}
+
+			~Host() {
+				if (saved != -1)
+					std::fesetround(saved);
+			}
+		};
+
+		//Bits of values
+
+		template<typename T>
+		using Bits = std::conditional_t<std::is_same_v<T, f32>, u32, u64>;
+
+		template<typename T>
+		static __forceinline Bits<T> bits(T v) {
+			Bits<T> b;
+			std::memcpy(&b, &v, sizeof(b));
+			return b;
+		}
+
+		template<typename T>
+		static __forceinline T value(Bits<T> b) {
+			T v;
+			std::memcpy(&v, &b, sizeof(v));
+			return v;
+		}
+
+		template<typename T>
+		static constexpr Bits<T> quietBit = Bits<T>(1) << (std::is_same_v<T, f32> ? 22 : 51);
+
+		template<typename T>
+		static __forceinline bool signaling(T v) {
+			return std::isnan(v) && !(bits(v) & quietBit<T>);
+		}
+
+		template<typename T>
+		static __forceinline T defaultNan() {
+			return value<T>(std::is_same_v<T, f32> ? Bits<T>(0x7FC00000) : Bits<T>(0x7FF8000000000000ull));
+		}
+
+		//Flush a subnormal input to zero (FZ); sets IDC
+		template<typename T>
+		__forceinline T input(T v, u32 &flags) const {
+
+			if ((fpscr & FZ) && std::fpclassify(v) == FP_SUBNORMAL) {
+				flags |= IDC;
+				return std::signbit(v) ? T(-0.0) : T(0);
+			}
+
+			return v;
+		}
+
+		//Flush a subnormal result to zero (FZ) and replace NaNs with the default NaN (DN)
+		template<typename T>
+		__forceinline T output(T v, u32 &flags) const {
+
+			if ((fpscr & FZ) && std::fpclassify(v) == FP_SUBNORMAL) {
+				flags |= UFC;
+				return std::signbit(v) ? T(-0.0) : T(0);
+			}
+
+			if ((fpscr & DN) && std::isnan(v))
+				return defaultNan<T>();
+
+			return v;
+		}
+
+		//The NaN an operation on a and b returns, if either is one:
+		//a signaling NaN (a first, quieted, sets IOC), otherwise a quiet NaN (a first)
+		template<typename T>
+		static __forceinline bool nan(T a, T b, T &result, u32 &flags) {
+
+			if (!std::isnan(a) && !std::isnan(b))
+				return false;
+
+			if (signaling(a) || signaling(b))
+				flags |= IOC;
+
+			const T n = signaling(a) ? a : signaling(b) ? b : std::isnan(a) ? a : b;
+			result = value<T>(bits(n) | quietBit<T>);
+			return true;
+		}
+
+		//Store a value so the host computes it before the flags are read
+		template<typename T>
+		static __forceinline T commit(T v) {
+			volatile T t = v;
+			return t;
+		}
+
+		//Result of an operation on numbers; a NaN means it was invalid (inf - inf, 0 * inf, 0 / 0, sqrt(-x))
+		//The VFP returns the default NaN there, the host its own (negative on x86)
+		template<typename T>
+		static __forceinline T invalid(T v) {
+			return std::isnan(v) ? defaultNan<T>() : v;
+		}
+
+		template<typename T>
+		T arith(u32 op, T dv, T nv, T mv, u32 &flags) const;
+
+		template<typename T>
+		bool packed(u32 op, T *out, u32 di, u32 ni, u32 mi, u32 len);
+
+		template<typename T>
+		i32 toInt(T v, bool isSigned, bool truncate, u32 &flags) const;
+
+		template<typename T>
+		u32 compare(T a, T b, bool quietNanTraps, u32 &flags) const;
+
+		//Apply the flags of an instruction; false if one of them traps
+		bool raise(u32 flags) {
+
+			if (flags & (fpscr >> trapShift) & (IOC | DZC | OFC | UFC | IXC | IDC)) {
+				fpexc |= EX;
+				return false;
+			}
+
+			fpscr |= flags;
+			return true;
+		}
+
+	};
+
+	//Data processing
+
+	template<typename T>
+	T Vfp::arith(u32 op, T dv, T nv, T mv, u32 &flags) const {
+
+		T p, result;
+
+		//FMAC/FNMAC/FMSC/FNMSC round the product, then add it to (-)Fd
+
+		if (op < 4) {
+
+			if (!nan(nv, mv, p, flags))
+				p = invalid(commit(nv * mv));
+
+			if (op & 1)
+				p = -p;
+
+			if (op & 2)
+				dv = -dv;
+
+			if (!nan(dv, p, result, flags))
+				result = invalid(commit(dv + p));
+
+			return output(result, flags);
+		}
+
+		switch (op) {
+
+			case 4:
+			case 5:
+
+				if (!nan(nv, mv, result, flags))
+					result = invalid(commit(nv * mv));
+
+				if (op == 5 && !std::isnan(result))
+					result = -result;
+
+				break;
+
+			case 6:
+				if (!nan(nv, mv, result, flags))
+					result = invalid(commit(nv + mv));
+				break;
+
+			case 7:
+				if (!nan(nv, mv, result, flags))
+					result = invalid(commit(nv - mv));
+				break;
+
+			default:
+				if (!nan(nv, mv, result, flags))
+					result = invalid(commit(nv / mv));
+		}
+
+		return output(result, flags);
+	}
+
+	//Vector of contiguous registers on packed SSE; false if it has to go through arith
+	//(NaN operands, flush-to-zero and default NaN need the scalar rules)
+
+	template<typename T>
+	bool Vfp::packed(u32 op, T *out, u32 di, u32 ni, u32 mi, u32 len) {
+
+		#if defined(__SSE2__) || defined(_M_X64)
+
+			if (fpscr & (FZ | DN))
+				return false;
+
+			const T *f = file<T>();
+			constexpr u32 lanes = 16 / sizeof(T);
+
+			for (u32 i = 0; i < len; ++i)
+				if (std::isnan(f[di + i]) || std::isnan(f[ni + i]) || std::isnan(f[mi + i]))
+					return false;
+
+			u32 i = 0;
+
+			for (; i + lanes <= len; i += lanes) {
+
+				if constexpr (std::is_same_v<T, f32>) {
+
+					const __m128 dv = _mm_loadu_ps(f + di + i), nv = _mm_loadu_ps(f + ni + i), mv = _mm_loadu_ps(f + mi + i);
+					__m128 res;
+
+					switch (op) {
+						case 0: res = _mm_add_ps(dv, _mm_mul_ps(nv, mv)); break;
+						case 1: res = _mm_sub_ps(dv, _mm_mul_ps(nv, mv)); break;
+						case 2: res = _mm_sub_ps(_mm_mul_ps(nv, mv), dv); break;
+						case 3: res = _mm_sub_ps(_mm_xor_ps(dv, _mm_set1_ps(-0.f)), _mm_mul_ps(nv, mv)); break;
+						case 4: res = _mm_mul_ps(nv, mv); break;
+						case 5: res = _mm_xor_ps(_mm_mul_ps(nv, mv), _mm_set1_ps(-0.f)); break;
+						case 6: res = _mm_add_ps(nv, mv); break;
+						case 7: res = _mm_sub_ps(nv, mv); break;
+						default: res = _mm_div_ps(nv, mv);
+					}
+
+					const __m128 invalid = _mm_cmpunord_ps(res, res);
+					res = _mm_or_ps(_mm_andnot_ps(invalid, res), _mm_and_ps(invalid, _mm_set1_ps(defaultNan<f32>())));
+
+					_mm_storeu_ps(out + i, res);
+
+				} else {
+
+					const __m128d dv = _mm_loadu_pd(f + di + i), nv = _mm_loadu_pd(f + ni + i), mv = _mm_loadu_pd(f + mi + i);
+					__m128d res;
+
+					switch (op) {
+						case 0: res = _mm_add_pd(dv, _mm_mul_pd(nv, mv)); break;
+						case 1: res = _mm_sub_pd(dv, _mm_mul_pd(nv, mv)); break;
+						case 2: res = _mm_sub_pd(_mm_mul_pd(nv, mv), dv); break;
+						case 3: res = _mm_sub_pd(_mm_xor_pd(dv, _mm_set1_pd(-0.0)), _mm_mul_pd(nv, mv)); break;
+						case 4: res = _mm_mul_pd(nv, mv); break;
+						case 5: res = _mm_xor_pd(_mm_mul_pd(nv, mv), _mm_set1_pd(-0.0)); break;
+						case 6: res = _mm_add_pd(nv, mv); break;
+						case 7: res = _mm_sub_pd(nv, mv); break;
+						default: res = _mm_div_pd(nv, mv);
+					}
+
+					const __m128d invalid = _mm_cmpunord_pd(res, res);
+					res = _mm_or_pd(_mm_andnot_pd(invalid, res), _mm_and_pd(invalid, _mm_set1_pd(defaultNan<f64>())));
+
+					_mm_storeu_pd(out + i, res);
+				}
+			}
+
+			u32 flags{};
+
+			for (; i < len; ++i)
+				out[i] = arith<T>(op, f[di + i], f[ni + i], f[mi + i], flags);
+
+			return true;
+
+		#else
+			(void) op; (void) out; (void) di; (void) ni; (void) mi; (void) len;
+			return false;
+		#endif
+	}
+
+	//FTOUI/FTOSI; in the FPSCR rounding mode or towards zero (Z)
+	//Out of range saturates and NaN becomes 0, both set IOC
+
+	template<typename T>
+	i32 Vfp::toInt(T v, bool isSigned, bool truncate, u32 &flags) const {
+
+		v = input(v, flags);
+
+		if (std::isnan(v)) {
+			flags |= IOC;
+			return 0;
+		}
+
+		const f64 rounded = truncate ? std::trunc(f64(v)) : std::nearbyint(f64(v));
+		const f64 lo = isSigned ? -2147483648.0 : 0.0, hi = isSigned ? 2147483647.0 : 4294967295.0;
+
+		if (rounded < lo || rounded > hi) {
+			flags |= IOC;
+			return i32(u32(rounded < lo ? (isSigned ? 0x80000000 : 0) : (isSigned ? 0x7FFFFFFF : 0xFFFFFFFF)));
+		}
+
+		if (rounded != f64(v))
+			flags |= IXC;
+
+		return isSigned ? i32(rounded) : i32(u32(rounded));
+	}
+
+	//FCMP/FCMPE; returns the FPSCR NZCV, unordered is C and V
+	//FCMP only traps on signaling NaNs, FCMPE on any NaN
+
+	template<typename T>
+	u32 Vfp::compare(T a, T b, bool quietNanTraps, u32 &flags) const {
+
+		a = input(a, flags);
+		b = input(b, flags);
+
+		u32 nzcv;
+
+		if (std::isnan(a) || std::isnan(b)) {
+
+			if (quietNanTraps || signaling(a) || signaling(b))
+				flags |= IOC;
+
+			nzcv = 0x3;
+		}
+
+		else if (a == b) nzcv = 0x6;
+		else if (a < b) nzcv = 0x8;
+		else nzcv = 0x2;
+
+		return nzcv;
+	}
+
+	//Extension operations (opcode 1111); the operation is in Fn and N
+	//Only FCPY/FABS/FNEG/FSQRT are vectors; those go through dataProc. Runs in the host environment of dataProc
+	//Comparisons return their NZCV, which dataProc writes once the flags didn't trap
+
+	template<typename T>
+	bool Vfp::extension(u32 ir, u32 op, u32 &flags, u32 &nzcv) {
+
+		constexpr bool isDouble = std::is_same_v<T, f64>;
+
+		const u32 sd = ((ir >> 11) & 0x1E) | ((ir >> 22) & 1), sm = ((ir << 1) & 0x1E) | ((ir >> 5) & 1);
+		const u32 dd = (ir >> 12) & 0xF, dm = ir & 0xF;
+		const u32 fd = isDouble ? dd : sd, fm = isDouble ? dm : sm;
+
+		T *f = file<T>();
+
+		switch (op) {
+
+			//FCMP{E}{Z}
+
+			case 0b01000:
+			case 0b01001:
+			case 0b01010:
+			case 0b01011:
+				nzcv = compare(f[fd], op & 2 ? T(0) : f[fm], op & 1, flags);
+				return true;
+
+			//FCVTDS (Dd = Sm) / FCVTSD (Sd = Dm)
+
+			case 0b01111:
+
+				if constexpr (isDouble) {
+
+					const f64 v = input(d[dm], flags);
+					f32 result;
+
+					if (std::isnan(v)) {
+						flags |= signaling(v) ? IOC : 0;
+						result = f32(value<f64>(bits(v) | quietBit<f64>));
+					} else
+						result = commit(f32(v));
+
+					s[sd] = output(result, flags);
+
+				} else {
+
+					const f32 v = input(s[sm], flags);
+					flags |= signaling(v) ? IOC : 0;
+
+					d[dd] = output(std::isnan(v) ? f64(value<f32>(bits(v) | quietBit<f32>)) : f64(v), flags);
+				}
+
+				return true;
+
+			//FUITO/FSITO; from the integer in Sm
+
+			case 0b10000:
+			case 0b10001:
+
+				if (op & 1)
+					f[fd] = commit(T(i32(raw[sm])));
+				else
+					f[fd] = commit(T(raw[sm]));
+
+				return true;
+
+			//FTOUI{Z}/FTOSI{Z}; into Sd
+
+			case 0b11000:
+			case 0b11001:
+			case 0b11010:
+			case 0b11011:
+				raw[sd] = u32(toInt(f[fm], op & 2, op & 1, flags));
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	//FMAC, FNMAC, FMSC, FNMSC, FMUL, FNMUL, FADD, FSUB, FDIV and the extension operations
+	//Vectors (LEN > 1) if Fd isn't in the first bank; Fm stays scalar if it's in the first bank
+	//The results are written once all are computed, so a trap leaves the registers alone
+
+	template<typename T, typename Cycles>
+	bool Vfp::dataProc(u32 ir, Cycles &cycles) {
+
+		constexpr bool isDouble = std::is_same_v<T, f64>;
+		constexpr u32 bank = isDouble ? 3 : 7;
+
+		const u32 op = ((ir >> 20) & 8) | ((ir >> 19) & 6) | ((ir >> 6) & 1);
+
+		u32 di, ni, mi;
+
+		if constexpr (isDouble) {
+			di = (ir >> 12) & 0xF;
+			ni = (ir >> 16) & 0xF;
+			mi = ir & 0xF;
+		} else {
+			di = ((ir >> 11) & 0x1E) | ((ir >> 22) & 1);
+			ni = ((ir >> 15) & 0x1E) | ((ir >> 7) & 1);
+			mi = ((ir << 1) & 0x1E) | ((ir >> 5) & 1);
+		}
+
+		u32 flags{};
+		const u32 ext = ((ir >> 15) & 0x1E) | ((ir >> 7) & 1);
+
+		if (op > 8 && op < 15)
+			return false;
+
+		//Scalar extension operations write their result directly; a trap puts the registers back
+
+		if (op == 15 && ext > 0b00011) {
+
+			u32 saved[32];
+			std::memcpy(saved, raw, sizeof(saved));
+
+			u32 nzcv = fpscr >> 28;
+			Host host(rounding());
+
+			if (!extension<T>(ir, ext, flags, nzcv))
+				return false;
+
+			if (raise(flags | host.flags())) {
+				fpscr = (fpscr & 0x0FFFFFFF) | (nzcv << 28);
+				return true;
+			}
+
+			std::memcpy(raw, saved, sizeof(saved));
+			return false;
+		}
+
+		//Vector or scalar
+
+		const u32 len = (di & ~bank) ? length() : 1, stride = this->stride();
+		const bool scalarM = !(mi & ~bank);
+
+		T *f = file<T>();
+		T out[8];
+
+		cycles += len - 1;
+
+		if (op == 8 || (op == 15 && ext == 0b00011))
+			cycles += (isDouble ? 28 : 14) * len;
+
+		else if (isDouble && op < 6)
+			cycles += len;
+
+		Host host(rounding());
+
+		const bool contiguous = len > 1 && stride == 1 && !scalarM && op != 15 &&
+			(di & bank) + len <= bank + 1 && (ni & bank) + len <= bank + 1 && (mi & bank) + len <= bank + 1;
+
+		if (!contiguous || !packed<T>(op, out, di, ni, mi, len))
+			for (u32 i = 0, dc = di, nc = ni, mc = mi; i < len; ++i) {
+
+				if (op == 15) {
+
+					switch (ext) {
+
+						case 0b00000: out[i] = f[mc]; break;
+						case 0b00001: out[i] = value<T>(bits(f[mc]) & ~(Bits<T>(1) << (sizeof(T) * 8 - 1))); break;
+						case 0b00010: out[i] = value<T>(bits(f[mc]) ^ (Bits<T>(1) << (sizeof(T) * 8 - 1))); break;
+
+						//Only FSQRT flushes its input; FCPY/FABS/FNEG just move bits
+
+						default: {
+
+							const T mv = input(f[mc], flags);
+							T result;
+
+							if (!nan(mv, mv, result, flags))
+								result = invalid(commit(std::sqrt(mv)));
+
+							out[i] = output(result, flags);
+						}
+					}
+
+				} else
+					out[i] = arith<T>(op, input(f[dc], flags), input(f[nc], flags), input(f[mc], flags), flags);
+
+				dc = (dc & ~bank) | ((dc + stride) & bank);
+				nc = (nc & ~bank) | ((nc + stride) & bank);
+
+				if (!scalarM)
+					mc = (mc & ~bank) | ((mc + stride) & bank);
+			}
+
+		if (!raise(flags | host.flags()))
+			return false;
+
+		for (u32 i = 0, dc = di; i < len; ++i) {
+			f[dc] = out[i];
+			dc = (dc & ~bank) | ((dc + stride) & bank);
+		}
+
+		return true;
+	}
+
+	//FLDS/FSTS/FLDD/FSTD and FLDM/FSTM (IA, DB with writeback)
+	//FLDMX/FSTMX (odd offset) skip their format word after the doubles; only the writeback covers it
+	//Every word takes a cycle, loads one more
+
+	template<typename Memory, typename Cycles>
+	bool Vfp::loadStore(Registers &r, Memory &mem, const u8 *m, Cycles &cycles) {
+
+		const u32 ir = r.ir;
+		const bool isDouble = ir & 0x100, load = ir & 0x100000, up = ir & 0x800000;
+		const bool pre = ir & 0x1000000, writeBack = ir & 0x200000;
+
+		const u32 rn = (ir >> 16) & 0xF, offset = ir & 0xFF;
+		u32 &base = r.registers[m[rn]];
+		const u32 address = rn == Register::pc ? base & ~3 : base;
+
+		u32 first = isDouble ? ((ir >> 12) & 0xF) * 2 : ((ir >> 11) & 0x1E) | ((ir >> 22) & 1);
+		u32 words, start;
+
+		//Single register
+
+		if (pre && !writeBack) {
+			words = isDouble ? 2 : 1;
+			start = up ? address + offset * 4 : address - offset * 4;
+		}
+
+		//Multiple; increment after or decrement before
+
+		else if (pre != up) {
+
+			words = isDouble ? offset & ~1 : offset;
+
+			if (!words || first + words > 32)
+				return false;
+
+			start = up ? address : address - offset * 4;
+
+			if (writeBack)
+				base = up ? address + offset * 4 : address - offset * 4;
+
+		} else return false;
+
+		if (load) {
+
+			++cycles;
+
+			for (u32 i = 0; i < words; ++i)
+				raw[first + i] = mem.template get<u32>(start + i * 4);
+
+		} else
+			for (u32 i = 0; i < words; ++i)
+				mem.template set<u32>(start + i * 4, raw[first + i]);
+
+		cycles += words;
+		return true;
+	}
+
+	//FMSR/FMRS, FMDLR/FMRDL, FMDHR/FMRDH and FMXR/FMRX (FPSID, FPSCR, FPEXC)
+	//FMRX r15, FPSCR is FMSTAT; it copies the FPSCR flags into the cpsr
+
+	inline bool Vfp::transfer(Registers &r, const u8 *m) {
+
+		const u32 ir = r.ir;
+		const u32 op = (ir >> 21) & 7, rd = (ir >> 12) & 0xF;
+		const bool toArm = ir & 0x100000;
+
+		u32 &reg = r.registers[m[rd]];
+
+		if (ir & 0x100) {
+
+			if (op > 1 || !enabled())
+				return false;
+
+			u32 &half = raw[((ir >> 16) & 0xF) * 2 + op];
+
+			if (toArm) reg = half;
+			else half = reg;
+
+			return true;
+		}
+
+		if (op == 0) {
+
+			if (!enabled())
+				return false;
+
+			u32 &single = raw[((ir >> 15) & 0x1E) | ((ir >> 7) & 1)];
+
+			if (toArm) reg = single;
+			else single = reg;
+
+			return true;
+		}
+
+		if (op != 7)
+			return false;
+
+		switch ((ir >> 16) & 0xF) {
+
+			case 0:
+
+				if (toArm)
+					reg = fpsid;
+
+				return true;
+
+			case 1:
+
+				if (!enabled())
+					return false;
+
+				if (!toArm)
+					fpscr = reg & fpscrMask;
+
+				else if (rd == Register::pc)
+					r.cpsr.value = (r.cpsr.value & 0x0FFFFFFF) | (fpscr & 0xF0000000);
+
+				else reg = fpscr;
+
+				return true;
+
+			case 8:
+
+				if (toArm)
+					reg = fpexc;
+				else
+					fpexc = reg & (EN | EX);
+
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	//FMDRR/FMRRD (Dm = Rn:Rd) and FMSRR/FMRRS (Sm, Sm + 1 = Rd, Rn)
+
+	inline bool Vfp::transferPair(Registers &r, const u8 *m) {
+
+		const u32 ir = r.ir;
+
+		if (!enabled() || (ir & 0xD0) != 0x10)
+			return false;
+
+		const u32 first = ir & 0x100 ? (ir & 0xF) * 2 : ((ir << 1) & 0x1E) | ((ir >> 5) & 1);
+
+		if (first == 31)
+			return false;
+
+		u32 &lo = r.registers[m[(ir >> 12) & 0xF]], &hi = r.registers[m[(ir >> 16) & 0xF]];
+
+		if (ir & 0x100000) {
+			lo = raw[first];
+			hi = raw[first + 1];
+		} else {
+			raw[first] = lo;
+			raw[first + 1] = hi;
+		}
+
+		return true;
+	}
+
+	template<typename Memory, typename Cycles>
+	bool Vfp::step(Registers &r, Memory &mem, const u8 *m, Cycles &cycles) {
+
+		const u32 ir = r.ir;
+
+		//LDC/STC space; MCRR/MRRC are the P = U = W = 0, D = 1 encodings
+
+		if (((ir >> 25) & 7) == 6) {
+
+			if ((ir & 0x1E00000) == 0x400000)
+				return transferPair(r, m);
+
+			return enabled() && loadStore(r, mem, m, cycles);
+		}
+
+		if (ir & 0x10)
+			return transfer(r, m);
+
+		if (!enabled())
+			return false;
+
+		return ir & 0x100 ? dataProc<f64>(ir, cycles) : dataProc<f32>(ir, cycles);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,1306 @@
+#include "arm/armulator_source.hpp"
+#include "arm/perf_counters.hpp"
+#include "arm/thumb/assembler.hpp"
+#include "arm/thumb/lockstep.hpp"
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <memory>
+
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+//Microbenchmarks of the interpreter on thumb kernels, assembled with the thumb assembler (arm/thumb/assembler.hpp)
+//Every kernel is called through Armulator::call (the bounded run loop) and checked against a host implementation.
+//Prints JSON (MIPS, ns per guest instruction and host IPC if perf counters are available) to compare builds.
+//Every kernel is also timed under the cheaper cycle models (APPROXIMATE and NONE, see Armulator::CycleModel).
+//--fuse profiles each kernel's instruction pairs first and fuses the common ones (see arm/thumb/fusion.hpp).
+//--verify-fusion runs random pair heavy programs with and without fusion instead and compares the results.
+//--verify-dsp checks the ARMv5TE DSP instructions (see arm/arm_dsp.hpp) against a host reference instead.
+//--verify-lockstep runs random programs over lockstep lanes (see arm/thumb/lockstep.hpp) and on stepThumb and compares them.
+//Usage: armulator_bench [--runs n] [--kernel name] [--output file] [--fuse]
+//	[--verify-fusion [seeds]] [--verify-dsp [sets]] [--verify-lockstep [seeds]]
+
+using namespace arm;
+using namespace arm::thumb;
+
+static constexpr auto version = Armulator::ARM7TDMI;
+
+static constexpr u32 codeBase = 0x02000000, dataBase = 0x02010000, stackTop = 0x0203FF00;
+static constexpr u32 dataSize = 0x10000;
+
+//Host side counters of the calling thread (Linux perf events); unavailable elsewhere or without permission
+
+struct HostCounters {
+
+	bool available{};
+
+	#ifdef __linux__
+
+		int leader = -1, instructions = -1;
+
+		static int open(u64 config, int group) {
+
+			perf_event_attr attr{};
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = config;
+			attr.disabled = group < 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+
+			return int(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+		}
+
+		HostCounters() {
+
+			leader = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+
+			if (leader >= 0)
+				instructions = open(PERF_COUNT_HW_INSTRUCTIONS, leader);
+
+			available = leader >= 0 && instructions >= 0;
+		}
+
+		~HostCounters() {
+
+			if (instructions >= 0)
+				close(instructions);
+
+			if (leader >= 0)
+				close(leader);
+		}
+
+		void start() {
+			if (available) {
+				ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			}
+		}
+
+		//Returns cycles and instructions since start
+		bool stop(u64 &cycles, u64 &retired) {
+
+			if (!available)
+				return false;
+
+			ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+			u64 values[3]{};
+
+			if (read(leader, values, sizeof(values)) != ssize_t(sizeof(values)))
+				return false;
+
+			cycles = values[1];
+			retired = values[2];
+			return true;
+		}
+
+	#else
+
+		void start() {}
+		bool stop(u64&, u64&) { return false; }
+
+	#endif
+
+};
+
+//Kernels
+
+struct Kernel {
+
+	const c8 *name;
+
+	//Assemble at the emitter, returns the entry (thumb bit set)
+	u32 (*assemble)(Assembler &a);
+
+	//Prepare the data and arguments; returns the expected result
+	u64 (*prepare)(Armulator &arm, u32 args[4]);
+
+	//The result of a call, to compare with the expected one; from the returned r0 or from memory
+	u64 (*result)(Armulator &arm, u64 returned);
+
+	//Calls per timed run, so every run is a few ms
+	u32 calls;
+
+};
+
+//Most kernels return their result in r0
+
+static u64 returnedResult(Armulator&, u64 returned) {
+	return returned;
+}
+
+//Shifts, adds and xors on registers only
+
+static u32 aluAssemble(Assembler &a) {
+
+	const u32 entry = a.address();
+
+	a.emit(mov(thumb::r1, u8(0)));
+	a.emit(mov(thumb::r2, u8(0x5A)));
+
+	const Label loop = a.here();
+
+	a.emit(add(thumb::r1, thumb::r1, thumb::r0));
+	a.emit(eor(thumb::r2, thumb::r1));
+	a.emit(lsl(thumb::r3, thumb::r2, Value5(3)));
+	a.emit(lsr(thumb::r4, thumb::r2, Value5(7)));
+	a.emit(orr(thumb::r3, thumb::r4));
+	a.emit(add(thumb::r2, thumb::r2, thumb::r3));
+	a.emit(sub(thumb::r0, u8(1)));
+	a.b(cond::NE, loop);
+
+	a.emit(add(thumb::r0, thumb::r2, Value3(0)));
+	a.emit(bx(HiReg::lr));
+
+	return entry | 1;
+}
+
+static u64 aluPrepare(Armulator&, u32 args[4]) {
+
+	const u32 n = 1 << 20;
+	u32 a{}, b = 0x5A;
+
+	for (u32 i = n; i; --i) {
+		a += i;
+		b ^= a;
+		b += (b << 3) | (b >> 7);
+	}
+
+	args[0] = n;
+	return b;
+}
+
+//Copy in blocks of 16 bytes through LDMIA/STMIA
+
+static u32 memcpyAssemble(Assembler &a) {
+
+	const u32 entry = a.address();
+
+	a.emit(pushLr(0x70));
+
+	const Label loop = a.here();
+
+	a.emit(ldmia(thumb::r1, 0x78));
+	a.emit(stmia(thumb::r0, 0x78));
+	a.emit(sub(thumb::r2, u8(1)));
+	a.b(cond::NE, loop);
+
+	a.emit(popPc(0x70));
+
+	return entry | 1;
+}
+
+static u64 memcpyPrepare(Armulator &arm, u32 args[4]) {
+
+	const u32 half = dataSize / 2;
+	u64 sum{};
+
+	for (u32 i = 0; i < half; i += 4) {
+		const u32 v = i * 0x9E3779B1u;
+		arm.memory.set(dataBase + i, v);
+		arm.memory.set(dataBase + half + i, u32(0));
+		sum += v;
+	}
+
+	args[0] = dataBase + half;
+	args[1] = dataBase;
+	args[2] = half / 16;
+	return sum;
+}
+
+static u64 memcpyResult(Armulator &arm, u64) {
+
+	const u32 half = dataSize / 2;
+	u64 sum{};
+
+	for (u32 i = 0; i < half; i += 4)
+		sum += arm.memory.get<u32>(dataBase + half + i);
+
+	return sum;
+}
+
+//Count the bytes above a key; the branch depends on random data
+
+static u32 searchAssemble(Assembler &a) {
+
+	const u32 entry = a.address();
+
+	a.emit(mov(thumb::r3, u8(0)));
+
+	const Label loop = a.here();
+
+	a.emit(sub(thumb::r1, u8(1)));
+	a.emit(ldrb(thumb::r5, thumb::r0, thumb::r1));
+	a.emit(cmp(thumb::r5, thumb::r2));
+	const Label skip = a.label();
+	a.b(cond::LS, skip);
+	a.emit(add(thumb::r3, u8(1)));
+	a.bind(skip);
+
+	a.emit(cmp(thumb::r1, u8(0)));
+	a.b(cond::NE, loop);
+
+	a.emit(add(thumb::r0, thumb::r3, Value3(0)));
+	a.emit(bx(HiReg::lr));
+
+	return entry | 1;
+}
+
+static u64 searchPrepare(Armulator &arm, u32 args[4]) {
+
+	std::mt19937 random(1234);
+	u64 count{};
+
+	for (u32 i = 0; i < dataSize; ++i) {
+		const u8 v = u8(random());
+		arm.memory.set(dataBase + i, v);
+		count += v > 0x80;
+	}
+
+	args[0] = dataBase;
+	args[1] = dataSize;
+	args[2] = 0x80;
+	return count;
+}
+
+//Recursive fibonacci; calls, returns and stack traffic
+
+static u32 fibAssemble(Assembler &a) {
+
+	const u32 entry = a.address();
+	const Label fib = a.here(), base = a.label();
+
+	a.emit(pushLr(0x30));
+	a.emit(cmp(thumb::r0, u8(2)));
+	a.b(cond::CC, base);
+
+	a.emit(add(thumb::r4, thumb::r0, Value3(0)));
+	a.emit(sub(thumb::r0, u8(1)));
+	a.bl(fib);
+	a.emit(add(thumb::r5, thumb::r0, Value3(0)));
+	a.emit(sub(thumb::r0, thumb::r4, Value3(2)));
+	a.bl(fib);
+	a.emit(add(thumb::r0, thumb::r0, thumb::r5));
+
+	a.bind(base);
+	a.emit(popPc(0x30));
+
+	return entry | 1;
+}
+
+static u64 fibPrepare(Armulator&, u32 args[4]) {
+
+	u32 a{}, b = 1;
+
+	for (u32 i = 0; i < 22; ++i) {
+		const u32 c = a + b;
+		a = b;
+		b = c;
+	}
+
+	args[0] = 22;
+	return a;
+}
+
+//FNV-1a over words; a multiply per word
+
+static u32 checksumAssemble(Assembler &a) {
+
+	const u32 entry = a.address();
+	const Label loop = a.here();
+
+	a.emit(ldmia(thumb::r0, 0x10));
+	a.emit(eor(thumb::r2, thumb::r4));
+	a.emit(mul(thumb::r2, thumb::r3));
+	a.emit(sub(thumb::r1, u8(1)));
+	a.b(cond::NE, loop);
+
+	a.emit(add(thumb::r0, thumb::r2, Value3(0)));
+	a.emit(bx(HiReg::lr));
+
+	return entry | 1;
+}
+
+static u64 checksumPrepare(Armulator &arm, u32 args[4]) {
+
+	u32 hash = 2166136261u;
+
+	for (u32 i = 0; i < dataSize; i += 4) {
+		const u32 v = i * 0x85EBCA6Bu;
+		arm.memory.set(dataBase + i, v);
+		hash = (hash ^ v) * 16777619u;
+	}
+
+	args[0] = dataBase;
+	args[1] = dataSize / 4;
+	args[2] = 2166136261u;
+	args[3] = 16777619u;
+	return hash;
+}
+
+static const Kernel kernels[] = {
+	{ "alu", aluAssemble, aluPrepare, returnedResult, 1 },
+	{ "memcpy", memcpyAssemble, memcpyPrepare, memcpyResult, 256 },
+	{ "search", searchAssemble, searchPrepare, returnedResult, 16 },
+	{ "fib", fibAssemble, fibPrepare, returnedResult, 16 },
+	{ "checksum", checksumAssemble, checksumPrepare, returnedResult, 64 }
+};
+
+//Runner
+
+struct Result {
+	const Kernel *kernel;
+	bool ok;
+	u64 instructions, cycles;
+	f64 best, mean;
+	f64 approximate, none;		//Best times under the other cycle models
+	u32 fused;
+	bool host;
+	u64 hostCycles, hostInstructions;
+};
+
+template<typename Hooks = NoHooks, Armulator::CycleModel model = Armulator::CycleModel::EXACT>
+static u64 invoke(Armulator &arm, u32 entry, const u32 args[4]) {
+	arm.r.reg(Register::sp) = stackTop;
+	return arm.call<version, Hooks, model>(entry, args[0], args[1], args[2], args[3]);
+}
+
+//Best time per call under a cycle model; the results are checked like the ones of the exact runs
+template<Armulator::CycleModel model>
+static f64 bestTime(Armulator &arm, const Kernel &k, u32 entry, usz runs, bool &ok) {
+
+	u32 args[4]{};
+	f64 best = 1e30;
+
+	for (usz i = 0; i < runs; ++i) {
+
+		const u64 expected = k.prepare(arm, args);
+		u64 got{};
+
+		const auto t0 = std::chrono::steady_clock::now();
+
+		for (u32 j = 0; j < k.calls; ++j)
+			got = invoke<NoHooks, model>(arm, entry, args);
+
+		const f64 t = std::chrono::duration<f64>(std::chrono::steady_clock::now() - t0).count();
+
+		if (u32(k.result(arm, got)) != u32(expected))
+			ok = false;
+
+		if (t < best)
+			best = t;
+	}
+
+	return best / k.calls;
+}
+
+static Result measure(const Kernel &k, usz runs, bool fuse, HostCounters &host) {
+
+	Armulator arm({ { codeBase, stackTop + 0x100 - codeBase } });
+	arm.r.cpsr.value = Mode::SYS | PSR::iMask | PSR::fMask;
+	arm.sentinel = codeBase;
+
+	Assembler a({ arm.memory, codeBase + 0x10 });
+	const u32 entry = k.assemble(a);
+
+	Result res{};
+	res.kernel = &k;
+	res.ok = a.finish();
+
+	if (!res.ok)
+		std::fprintf(stderr, "%s: %s\n", k.name, a.error);
+
+	u32 args[4]{};
+	u64 expected = k.prepare(arm, args);
+
+	//Count the guest instructions once
+
+	PerfCounters counters;
+	counters.attach();
+
+	const usz start = arm.cycles;
+	arm.r.reg(Register::sp) = stackTop;
+	u64 got = arm.call<version, Counting<false, false>>(entry, args[0], args[1], args[2], args[3]);
+
+	counters.publish();
+	PerfCounters::detach();
+
+	const PerfCounters::Snapshot s = counters.snapshot();
+	res.instructions = s.thumbInstructions + s.armInstructions;
+	res.cycles = arm.cycles - start;
+
+	auto check = [&](u64 returned) {
+		if (u32(k.result(arm, returned)) != u32(expected))
+			res.ok = false;
+	};
+
+	check(got);
+
+	//Pick the pairs to fuse from a profile of the kernel itself
+
+	if (fuse) {
+
+		PairProfiler pairs;
+		pairs.attach();
+
+		k.prepare(arm, args);
+		invoke<PairProfile>(arm, entry, args);
+
+		PairProfiler::detach();
+		arm.fusion.choose(pairs);
+	}
+
+	res.fused = arm.fusion.pairs;
+
+	//Timed runs; the data is prepared again so every run does the same work
+	//The times are per call
+
+	f64 total{};
+	res.best = 1e30;
+
+	for (usz i = 0; i < runs; ++i) {
+
+		expected = k.prepare(arm, args);
+
+		host.start();
+		const auto t0 = std::chrono::steady_clock::now();
+
+		for (u32 j = 0; j < k.calls; ++j)
+			got = invoke(arm, entry, args);
+
+		const f64 t = std::chrono::duration<f64>(std::chrono::steady_clock::now() - t0).count();
+
+		u64 hostCycles{}, hostInstructions{};
+
+		if (host.stop(hostCycles, hostInstructions) && (!res.host || t < res.best)) {
+			res.host = true;
+			res.hostCycles = hostCycles;
+			res.hostInstructions = hostInstructions;
+		}
+
+		check(got);
+
+		total += t;
+
+		if (t < res.best)
+			res.best = t;
+	}
+
+	res.best /= k.calls;
+	res.mean = total / f64(runs) / k.calls;
+	res.hostCycles /= k.calls;
+	res.hostInstructions /= k.calls;
+
+	res.approximate = bestTime<Armulator::CycleModel::APPROXIMATE>(arm, k, entry, runs, res.ok);
+	res.none = bestTime<Armulator::CycleModel::NONE>(arm, k, entry, runs, res.ok);
+	return res;
+}
+
+//Fusion equivalence
+//Straight code made of the fused pairs (and near misses of them), calls with prologues and a loop around it all.
+//Every seed runs once without fusion and once with every pair fused; the registers and cpsr at the return,
+//the cycles and the stack have to be the same.
+
+static void randomProgram(Assembler &a, std::mt19937 &rnd) {
+
+	a.emit(pushLr(0));
+	a.emit(mov(thumb::r7, u8(50)));
+
+	const Label loop = a.here();
+
+	for (u32 i = 0; i < 40; ++i) {
+
+		const LoReg d = LoReg(rnd() % 6), s = LoReg(rnd() % 6), n = LoReg(rnd() % 6);
+
+		switch (rnd() % 9) {
+
+			//MOV_ADD
+
+			case 0:
+				a.emit(mov(d, u8(rnd())));
+				a.emit(add(d, u8(rnd())));
+				break;
+
+			case 1:
+				a.emit(mov(d, u8(rnd())));
+				a.emit(add(s, d, n));
+				break;
+
+			case 2:
+				a.emit(mov(d, u8(rnd())));
+				a.emit(add(s, d, Value3(rnd() % 8)));
+				break;
+
+			//CMP_BCC, with every condition and both CMP forms
+
+			case 3: {
+				const Label skip = a.label();
+				a.emit(cmp(d, u8(rnd())));
+				a.b(cond::Condition(rnd() % 14), skip);
+				a.emit(add(s, u8(3)));
+				a.bind(skip);
+				break;
+			}
+
+			case 4: {
+				const Label skip = a.label();
+				a.emit(cmp(d, s));
+				a.b(cond::Condition(rnd() % 14), skip);
+				a.emit(eor(n, d));
+				a.bind(skip);
+				break;
+			}
+
+			//LSL_ASR (sign extension of a byte or halfword)
+
+			case 5: {
+				const u8 shift = rnd() & 1 ? 16 : 24;
+				a.emit(lsl(d, s, Value5(shift)));
+				a.emit(asr(d, d, Value5(shift)));
+				break;
+			}
+
+			//Not a pair
+
+			case 6:
+				a.emit(add(d, d, n));
+				a.emit(lsl(n, s, Value5(rnd() % 32)));
+				break;
+
+			//LDR_ADD
+
+			case 7:
+				a.emit(ldr(d, thumb::r6, Value7((rnd() % 32) * 4)));
+				a.emit(add(s, d, n));
+				break;
+
+			//PUSH_SUB_SP in a called function
+
+			default: {
+
+				const Label function = a.label(), over = a.label();
+				const i16 frame = i16(4 * (rnd() % 16 + 1));
+
+				a.bl(function);
+				a.b(over);
+
+				a.bind(function);
+				a.emit(pushLr(0x0F));
+				a.emit(addSp(i16(-frame)));
+				a.emit(ldr(d, thumb::r6, Value7((rnd() % 32) * 4)));
+				a.emit(add(d, u8(1)));
+				a.emit(addSp(frame));
+				a.emit(popPc(0x0F));
+
+				a.bind(over);
+				break;
+			}
+		}
+	}
+
+	const Label done = a.label();
+
+	a.emit(sub(thumb::r7, u8(1)));
+	a.b(cond::EQ, done);
+	a.b(loop);
+	a.bind(done);
+	a.emit(popPc(0));
+}
+
+struct FusionResult {
+	Registers r;			//At the return
+	u64 cycles, stack;		//stack is a hash of the 4 KiB below the initial sp
+};
+
+static FusionResult runRandom(u32 seed, bool fused) {
+
+	std::mt19937 rnd(seed);
+
+	Armulator arm({ { codeBase, stackTop + 0x100 - codeBase } });
+	arm.r.cpsr.value = Mode::SYS | PSR::iMask | PSR::fMask;
+	arm.sentinel = codeBase;
+
+	Assembler a({ arm.memory, codeBase + 0x10 });
+	const u32 entry = a.address() | 1;
+
+	randomProgram(a, rnd);
+
+	if (!a.finish())
+		std::fprintf(stderr, "seed %u: %s\n", seed, a.error);
+
+	for (u32 i = 0; i < 256; i += 4)
+		arm.memory.set(dataBase + i, u32(rnd()));
+
+	for (usz i = 0; i < 6; ++i)
+		arm.r.loReg[i] = u32(rnd());
+
+	arm.r.loReg[6] = dataBase;
+	arm.r.reg(Register::sp) = stackTop;
+
+	if (fused)
+		for (usz i = 1; i < usz(Pair::COUNT); ++i)
+			arm.fusion.enable(Pair(i));
+
+	//call restores the cpsr, so the state is taken by a sentinel hook of our own (call only adds one if there is none)
+
+	FusionResult res{};
+
+	arm.hooks.add(arm.sentinel | 1, [](Armulator &arm, void *user) {
+		static_cast<FusionResult*>(user)->r = arm.r;
+		arm.stop();
+		arm.r.reg(Register::lr) = arm.sentinel | 1;
+	}, 0, &res);
+
+	arm.call<version>(entry);
+
+	res.cycles = arm.cycles;
+
+	for (u32 i = stackTop - 0x1000; i < stackTop; i += 4)
+		res.stack = res.stack * 31 + arm.memory.get<u32>(i);
+
+	return res;
+}
+
+//Returns the number of seeds that differ
+static usz verifyFusion(usz seeds) {
+
+	usz mismatches{};
+
+	for (u32 seed = 0; seed < seeds; ++seed) {
+
+		const FusionResult plain = runRandom(seed, false), fused = runRandom(seed, true);
+
+		bool same = plain.r.cpsr.value == fused.r.cpsr.value && plain.cycles == fused.cycles && plain.stack == fused.stack;
+
+		for (u8 i = 0; i < Register::count; ++i)
+			same &= plain.r.reg(Register(i)) == fused.r.reg(Register(i));
+
+		if (same)
+			continue;
+
+		if (mismatches++ < 8)
+			std::fprintf(
+				stderr, "seed %u: cycles %llu/%llu cpsr %08X/%08X\n", seed,
+				(unsigned long long) plain.cycles, (unsigned long long) fused.cycles, plain.r.cpsr.value, fused.r.cpsr.value
+			);
+	}
+
+	return mismatches;
+}
+
+//Lockstep equivalence
+//Straight code of every lane parallel instruction, forward branches on flags that differ per lane
+//and instructions that only run per lane (PUSH/POP, pc relative loads, hi registers).
+//The lanes start with different registers, flags and data. Every seed runs once in a lockstep group (lanes that diverge
+//finish on stepThumb) and once on stepThumb only; the registers, cpsr, cycles and memory of every lane have to be the same.
+
+static constexpr usz lockstepLanes = 8;
+
+//Returns the address of the final branch to itself
+static u32 lockstepProgram(Assembler &a, std::mt19937 &rnd) {
+
+	static constexpr TI (*const alu[])(LoReg, LoReg) = {
+		and, eor, lsl, lsr, asr, adc, sbc, ror, tst, neg, cmp, cmn, orr, mul, bic, mvn
+	};
+
+	for (u32 i = 0; i < 64; ++i) {
+
+		const LoReg d = LoReg(rnd() % 6), s = LoReg(rnd() % 6), n = LoReg(rnd() % 6);
+
+		switch (rnd() % 12) {
+
+			//ALU; ADC/SBC twice as often, their carry in is where the lanes differ most
+
+			case 0:
+				a.emit(alu[rnd() % 16](d, s));
+				break;
+
+			case 1:
+				a.emit(rnd() & 1 ? adc(d, s) : sbc(d, s));
+				break;
+
+			case 2:
+
+				switch (rnd() % 4) {
+					case 0: a.emit(mov(d, u8(rnd()))); break;
+					case 1: a.emit(cmp(d, u8(rnd()))); break;
+					case 2: a.emit(add(d, u8(rnd()))); break;
+					default: a.emit(sub(d, u8(rnd())));
+				}
+
+				break;
+
+			case 3:
+
+				switch (rnd() % 4) {
+					case 0: a.emit(add(d, s, n)); break;
+					case 1: a.emit(sub(d, s, n)); break;
+					case 2: a.emit(add(d, s, Value3(rnd() % 8))); break;
+					default: a.emit(sub(d, s, Value3(rnd() % 8)));
+				}
+
+				break;
+
+			case 4:
+
+				switch (rnd() % 3) {
+					case 0: a.emit(lsl(d, s, Value5(rnd() % 32))); break;
+					case 1: a.emit(lsr(d, s, Value5(rnd() % 32))); break;
+					default: a.emit(asr(d, s, Value5(rnd() % 32)));
+				}
+
+				break;
+
+			//Memory through r6 (data) and r7 (a per lane offset)
+
+			case 5:
+
+				switch (rnd() % 6) {
+					case 0: a.emit(ldr(d, thumb::r6, Value7((rnd() % 32) * 4))); break;
+					case 1: a.emit(str(d, thumb::r6, Value7((rnd() % 32) * 4))); break;
+					case 2: a.emit(ldrb(d, thumb::r6, Value5(rnd() % 32))); break;
+					case 3: a.emit(strh(d, thumb::r6, Value6((rnd() % 32) * 2))); break;
+					case 4: a.emit(ldsh(d, thumb::r6, thumb::r7)); break;
+					default: a.emit(strb(d, thumb::r6, thumb::r7));
+				}
+
+				break;
+
+			case 6:
+				a.emit(rnd() & 1 ? strSp(d, Value10((rnd() % 16) * 4)) : ldrSp(d, Value10((rnd() % 16) * 4)));
+				break;
+
+			//High registers
+
+			case 7:
+
+				switch (rnd() % 4) {
+					case 0: a.emit(mov(HiReg(rnd() % 5), d)); break;
+					case 1: a.emit(add(d, HiReg(rnd() % 5))); break;
+					case 2: a.emit(cmp(d, HiReg(rnd() % 5))); break;
+					default: a.emit(add(HiReg(rnd() % 5), HiReg(rnd() % 5)));
+				}
+
+				break;
+
+			//Forward branches on per lane flags
+
+			case 8:
+			case 9: {
+
+				const Label skip = a.label();
+				a.b(cond::Condition(rnd() % 14), skip);
+				a.emit(alu[rnd() % 16](d, s));
+
+				if (rnd() & 1)
+					a.emit(rnd() & 1 ? adc(n, d) : sbc(n, d));
+
+				a.bind(skip);
+				break;
+			}
+
+			//Per lane only
+
+			case 10:
+				a.emit(push(u8(1 << d | 1 << s)));
+				a.emit(pop(u8(1 << n | 1 << ((n + 1) % 6))));
+				break;
+
+			default:
+				a.emit(rnd() & 1 ? ldrPc(d, Value10((rnd() % 16) * 4)) : addPc(d, Value10((rnd() % 16) * 4)));
+		}
+	}
+
+	const u32 end = a.address();
+	const Label self = a.here();
+	a.b(self);
+	return end;
+}
+
+struct LaneResult {
+	Registers r;
+	u64 cycles, memory;		//memory is a hash of the data and the stack below the initial sp
+};
+
+//Run on stepThumb until the final branch
+static void finishScalar(Armulator &arm, u32 end) {
+
+	const u8 *m = Registers::mapping[Mode::toId(arm.r.cpsr.mode())] + 8;
+	usz cycles{};
+
+	for (usz i = 0; i < 4096 && arm.r.pc - 4 != end; ++i) {
+		stepThumb<version>(arm.r, arm.memory, m, cycles);
+		++cycles;
+	}
+
+	arm.cycles += cycles;
+}
+
+static void runLanes(u32 seed, bool lockstep, LaneResult (&out)[lockstepLanes]) {
+
+	std::unique_ptr<Armulator> arms[lockstepLanes];
+	Armulator *cores[lockstepLanes];
+	u32 end{};
+
+	for (usz i = 0; i < lockstepLanes; ++i) {
+
+		arms[i] = std::make_unique<Armulator>(List<Armulator::Memory::Range>{ { codeBase, stackTop + 0x100 - codeBase } });
+		Armulator &arm = *arms[i];
+		cores[i] = &arm;
+
+		std::mt19937 code(seed), state(u32(seed * lockstepLanes + i + 1));
+
+		Assembler a({ arm.memory, codeBase + 0x10 });
+		const u32 start = a.address();
+		end = lockstepProgram(a, code);
+
+		if (!a.finish())
+			std::fprintf(stderr, "seed %u: %s\n", seed, a.error);
+
+		//Edges of the carry in (0, ~0 and the signed limits) are more likely than in uniform values
+
+		static constexpr u32 edges[] = { 0, 1, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFE, 0xFFFFFFFF };
+
+		for (usz j = 0; j < 6; ++j)
+			arm.r.loReg[j] = state() & 1 ? edges[state() % 6] : u32(state());
+
+		arm.r.loReg[6] = dataBase;
+		arm.r.loReg[7] = (state() % 64) * 2;
+
+		for (usz j = 8; j < 13; ++j)
+			arm.r.registers[j] = u32(state());
+
+		arm.r.cpsr.value = Mode::SYS | PSR::iMask | PSR::fMask | PSR::tMask | (u32(state()) & 0xF0000000);
+		arm.r.reg(Register::sp) = stackTop;
+
+		for (u32 j = 0; j < 256; j += 4)
+			arm.memory.set(dataBase + j, u32(state()));
+
+		arm.r.pc = start;
+		prefetch(arm.r, arm.memory);
+	}
+
+	//The group stops at the final branch; lanes that left it finish on their own
+
+	if (lockstep) {
+
+		Lockstep<version, lockstepLanes> group(cores);
+
+		while (group.active()) {
+
+			group.sync();
+
+			if (cores[arm::ctz(group.active())]->r.pc - 4 == end)
+				break;
+
+			group.run(1);
+		}
+	}
+
+	for (usz i = 0; i < lockstepLanes; ++i) {
+
+		Armulator &arm = *arms[i];
+		finishScalar(arm, end);
+
+		LaneResult &res = out[i];
+		res.r = arm.r;
+		res.cycles = arm.cycles;
+		res.memory = 0;
+
+		for (u32 j = 0; j < 256; j += 4)
+			res.memory = res.memory * 31 + arm.memory.get<u32>(dataBase + j);
+
+		for (u32 j = stackTop - 64; j < stackTop; j += 4)
+			res.memory = res.memory * 31 + arm.memory.get<u32>(j);
+	}
+}
+
+//Returns the number of lanes that differ over all seeds
+static usz verifyLockstep(usz seeds) {
+
+	usz mismatches{};
+
+	for (u32 seed = 0; seed < seeds; ++seed) {
+
+		LaneResult group[lockstepLanes], scalar[lockstepLanes];
+		runLanes(seed, true, group);
+		runLanes(seed, false, scalar);
+
+		for (usz i = 0; i < lockstepLanes; ++i) {
+
+			const LaneResult &a = group[i], &b = scalar[i];
+			bool same = a.r.cpsr.value == b.r.cpsr.value && a.cycles == b.cycles && a.memory == b.memory;
+
+			for (u8 j = 0; j < Register::count; ++j)
+				same &= a.r.reg(Register(j)) == b.r.reg(Register(j));
+
+			if (same)
+				continue;
+
+			if (mismatches++ < 8)
+				std::fprintf(
+					stderr, "seed %u lane %zu: cycles %llu/%llu cpsr %08X/%08X r0 %08X/%08X\n", seed, i,
+					(unsigned long long) a.cycles, (unsigned long long) b.cycles, a.r.cpsr.value, b.r.cpsr.value, a.r.loReg[0], b.r.loReg[0]
+				);
+		}
+	}
+
+	return mismatches;
+}
+
+//DSP reference
+//Random operand sets (biased to the saturation edges) for every DSP instruction and x/y half, run one at a time on an ARM9E
+//and compared with the same math on 64-bit host integers; the result registers and Q have to match.
+//LDRD/STRD are checked on fixed cases of every addressing mode, and with an odd Rd, which has to be undefined.
+
+static i64 saturate(i64 v, bool &q) {
+
+	if (v > INT32_MAX || v < INT32_MIN) {
+		q = true;
+		return v < 0 ? INT32_MIN : INT32_MAX;
+	}
+
+	return v;
+}
+
+static i32 signedHalf(u32 v, u32 top) {
+	return top ? i32(v) >> 16 : i32(i16(v));
+}
+
+//Run the ARM instructions at codeBase on an ARM9E; returns true if the last one raised UND
+static bool runArm(Armulator &arm, const u32 *code, usz count) {
+
+	for (usz i = 0; i < count; ++i)
+		arm.memory.set(u32(codeBase + i * 4), code[i]);
+
+	arm.memory.set(u32(codeBase + count * 4), 0xEAFFFFFEu);		//B .
+
+	arm.r.cpsr.value = Mode::SYS | PSR::iMask | PSR::fMask;
+	arm.r.pc = codeBase;
+
+	const u8 *m = prefetch(arm.r, arm.memory);
+	usz cycles{};
+	bool refilled{};
+
+	for (usz i = 0; i < count; ++i)
+		refilled = stepArm<Armulator::ARM9E>(arm.r, arm.memory, m, cycles);
+
+	return refilled && arm.r.cpsr.mode() == Mode::UND;
+}
+
+//Returns the number of operand sets (and LDRD/STRD cases) that differ
+static usz verifyDsp(usz sets) {
+
+	static constexpr u32 edges[] = {
+		0, 1, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, 0x8000, 0x7FFF, 0xFFFF8000, 0x40000000, 0xC0000000
+	};
+
+	std::mt19937 rnd(5);
+	auto operand = [&]() { return rnd() % 3 ? edges[rnd() % 10] : u32(rnd()); };
+
+	usz mismatches{};
+
+	auto report = [&](const c8 *what, u32 ir, u32 got, u32 expected) {
+		if (mismatches++ < 8)
+			std::fprintf(stderr, "%s %08X: got %08X, expected %08X\n", what, ir, got, expected);
+	};
+
+	Armulator arm({ { codeBase, stackTop + 0x100 - codeBase } });
+
+	//r1 = Rm, r2 = Rs (or Rn of QADD), r3 = accumulator, r4 (and r5 for SMLAL) the result
+
+	for (usz i = 0; i < sets; ++i) {
+
+		const u32 rm = operand(), rs = operand(), acc = operand();
+		const u32 kind = rnd() % 9, x = rnd() & 1, y = rnd() & 1, halves = (y << 6) | (x << 5);
+
+		const u32 r4 = operand(), r5 = operand();
+
+		u32 ir{}, lo = r4, hi = r5;		//Expected r4 and r5
+		bool q{};
+
+		const i64 a = i32(rm), b = i32(rs);
+		const i64 product = i64(signedHalf(rm, x)) * signedHalf(rs, y);
+
+		switch (kind) {
+
+			//QADD, QSUB, QDADD, QDSUB r4, r1, r2
+
+			case 0: case 1: case 2: case 3: {
+
+				ir = 0xE1000050 | (kind << 21) | (2 << 16) | (4 << 12) | 1;
+
+				const i64 n = kind & 2 ? saturate(2 * b, q) : b;
+				lo = u32(saturate(kind & 1 ? a - n : a + n, q));
+				break;
+			}
+
+			//SMLAxy r4, r1, r2, r3
+
+			case 4: {
+				ir = 0xE1000080 | (4 << 16) | (3 << 12) | (2 << 8) | halves | 1;
+				const i64 sum = product + i32(acc);
+				q = sum != i32(sum);
+				lo = u32(sum);
+				break;
+			}
+
+			//SMLAWy r4, r1, r2, r3 / SMULWy r4, r1, r2
+
+			case 5: {
+
+				ir = 0xE1200080 | (4 << 16) | (3 << 12) | (2 << 8) | halves | 1;
+
+				const i64 p = (a * signedHalf(rs, y)) >> 16;
+
+				if (x)
+					lo = u32(p);
+				else {
+					const i64 sum = i64(i32(p)) + i32(acc);
+					q = sum != i32(sum);
+					lo = u32(sum);
+				}
+
+				break;
+			}
+
+			//SMLALxy r4, r5, r1, r2
+
+			case 6: {
+				ir = 0xE1400080 | (5 << 16) | (4 << 12) | (2 << 8) | halves | 1;
+				const u64 sum = ((u64(hi) << 32) | lo) + u64(product);
+				lo = u32(sum);
+				hi = u32(sum >> 32);
+				break;
+			}
+
+			//SMULxy r4, r1, r2
+
+			case 7:
+				ir = 0xE1600080 | (4 << 16) | (2 << 8) | halves | 1;
+				lo = u32(product);
+				break;
+
+			//CLZ r4, r1
+
+			default:
+
+				ir = 0xE16F0F10 | (4 << 12) | 1;
+				lo = 32;
+
+				for (u32 v = rm; v; v >>= 1)
+					--lo;
+		}
+
+		arm.r.loReg[1] = rm;
+		arm.r.loReg[2] = rs;
+		arm.r.loReg[3] = acc;
+		arm.r.loReg[4] = r4;
+		arm.r.loReg[5] = r5;
+
+		runArm(arm, &ir, 1);
+
+		if (arm.r.loReg[4] != lo)
+			report("result of", ir, arm.r.loReg[4], lo);
+
+		else if (arm.r.loReg[5] != hi)
+			report("high result of", ir, arm.r.loReg[5], hi);
+
+		else if (arm.r.cpsr.saturated() != q)
+			report("Q of", ir, arm.r.cpsr.saturated(), q);
+	}
+
+	//LDRD/STRD; r1 = 0x...FF8 is the base
+
+	const u32 data = dataBase + 0x1000;
+
+	static constexpr u32 transfers[] = {
+		0xE1C140D8,		//LDRD r4, [r1, #8]
+		0xE1E120F8,		//STRD r2, [r1, #8]!
+		0xE0C160F8,		//STRD r6, [r1], #8
+		0xE10180D9		//LDRD r8, [r1, -r9]
+	};
+
+	arm.memory.set(data, 0x11111111u);
+	arm.memory.set(data + 4, 0x22222222u);
+
+	arm.r.loReg[1] = data - 8;
+	arm.r.loReg[2] = 0xAAAA;
+	arm.r.loReg[3] = 0xBBBB;
+	arm.r.loReg[6] = 0x6666;
+	arm.r.loReg[7] = 0x7777;
+	arm.r.registers[Register::r9] = 8;
+
+	runArm(arm, transfers, 4);
+
+	const u32 results[][2] = {
+		{ arm.r.loReg[4], 0x11111111 }, { arm.r.loReg[5], 0x22222222 }, { arm.r.loReg[1], data + 8 },
+		{ arm.memory.get<u32>(data), 0x6666 }, { arm.memory.get<u32>(data + 4), 0x7777 },
+		{ arm.r.registers[Register::r8], 0x6666 }, { arm.r.registers[Register::r9], 0x7777 }
+	};
+
+	for (const auto &res : results)
+		if (res[0] != res[1])
+			report("LDRD/STRD", 0, res[0], res[1]);
+
+	//LDRD r5, [r1] is undefined and leaves memory and registers alone
+
+	const u32 odd = 0xE1C150D0;
+
+	arm.r.loReg[5] = 0x5555;
+
+	if (!runArm(arm, &odd, 1) || arm.r.loReg[5] != 0x5555)
+		report("LDRD with an odd Rd (UND)", odd, arm.r.loReg[5], 0x5555);
+
+	return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+
+	usz runs = 5, seeds{}, sets{}, groups{};
+	const c8 *filter{}, *output{};
+	bool fuse{};
+
+	for (int i = 1; i < argc; ++i) {
+
+		if (!std::strcmp(argv[i], "--runs") && i + 1 < argc)
+			runs = usz(std::strtoul(argv[++i], nullptr, 10));
+
+		else if (!std::strcmp(argv[i], "--kernel") && i + 1 < argc)
+			filter = argv[++i];
+
+		else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+			output = argv[++i];
+
+		else if (!std::strcmp(argv[i], "--fuse"))
+			fuse = true;
+
+		else if (!std::strcmp(argv[i], "--verify-fusion"))
+			seeds = i + 1 < argc && *argv[i + 1] != '-' ? usz(std::strtoul(argv[++i], nullptr, 10)) : 300;
+
+		else if (!std::strcmp(argv[i], "--verify-dsp"))
+			sets = i + 1 < argc && *argv[i + 1] != '-' ? usz(std::strtoul(argv[++i], nullptr, 10)) : 20000;
+
+		else if (!std::strcmp(argv[i], "--verify-lockstep"))
+			groups = i + 1 < argc && *argv[i + 1] != '-' ? usz(std::strtoul(argv[++i], nullptr, 10)) : 300;
+
+		else {
+			std::fprintf(
+				stderr,
+				"Usage: %s [--runs n] [--kernel name] [--output file] [--fuse]"
+				" [--verify-fusion [seeds]] [--verify-dsp [sets]] [--verify-lockstep [seeds]]\n",
+				argv[0]
+			);
+			return 1;
+		}
+	}
+
+	if (sets) {
+		const usz mismatches = verifyDsp(sets);
+		std::printf("{\n\t\"benchmark\": \"armulator_bench\",\n\t\"verify_dsp\": { \"sets\": %zu, \"mismatches\": %zu }\n}\n", sets, mismatches);
+		return mismatches ? 2 : 0;
+	}
+
+	if (groups) {
+		const usz mismatches = verifyLockstep(groups);
+		std::printf("{\n\t\"benchmark\": \"armulator_bench\",\n\t\"verify_lockstep\": { \"seeds\": %zu, \"mismatches\": %zu }\n}\n", groups, mismatches);
+		return mismatches ? 2 : 0;
+	}
+
+	if (seeds) {
+		const usz mismatches = verifyFusion(seeds);
+		std::printf("{\n\t\"benchmark\": \"armulator_bench\",\n\t\"verify_fusion\": { \"seeds\": %zu, \"mismatches\": %zu }\n}\n", seeds, mismatches);
+		return mismatches ? 2 : 0;
+	}
+
+	if (!runs)
+		runs = 1;
+
+	std::FILE *out = output ? std::fopen(output, "w") : stdout;
+
+	if (!out) {
+		std::fprintf(stderr, "Couldn't open %s\n", output);
+		return 1;
+	}
+
+	HostCounters host;
+	bool ok = true;
+
+	#if defined(__clang__)
+		const c8 *compiler = "clang " __clang_version__;
+	#elif defined(__GNUC__)
+		const c8 *compiler = "gcc " __VERSION__;
+	#elif defined(_MSC_VER)
+		const c8 *compiler = "msvc";
+	#else
+		const c8 *compiler = "unknown";
+	#endif
+
+	#ifdef NDEBUG
+		const c8 *build = "release";
+	#else
+		const c8 *build = "debug";
+	#endif
+
+	std::fprintf(
+		out, "{\n\t\"benchmark\": \"armulator_bench\",\n\t\"compiler\": \"%s\",\n\t\"build\": \"%s\",\n"
+		"\t\"runs\": %zu,\n\t\"fuse\": %s,\n\t\"host_counters\": %s,\n\t\"kernels\": [",
+		compiler, build, runs, fuse ? "true" : "false", host.available ? "true" : "false"
+	);
+
+	bool first = true;
+
+	for (const Kernel &k : kernels) {
+
+		if (filter && std::strcmp(filter, k.name))
+			continue;
+
+		const Result r = measure(k, runs, fuse, host);
+		ok &= r.ok;
+
+		std::fprintf(
+			out, "%s\n\t\t{\n\t\t\t\"name\": \"%s\",\n\t\t\t\"ok\": %s,\n"
+			"\t\t\t\"guest_instructions\": %llu,\n\t\t\t\"guest_cycles\": %llu,\n"
+			"\t\t\t\"best_seconds\": %.9f,\n\t\t\t\"mean_seconds\": %.9f,\n"
+			"\t\t\t\"mips\": %.3f,\n\t\t\t\"ns_per_instruction\": %.4f,\n\t\t\t\"fused_pairs\": [",
+			first ? "" : ",", k.name, r.ok ? "true" : "false",
+			(unsigned long long) r.instructions, (unsigned long long) r.cycles,
+			r.best, r.mean, r.instructions / r.best / 1e6, r.best * 1e9 / f64(r.instructions)
+		);
+
+		for (usz i = 1, n = 0; i < usz(Pair::COUNT); ++i)
+			if (r.fused & Fusion::bit(Pair(i)))
+				std::fprintf(out, "%s\"%s\"", n++ ? ", " : "", pairNames[i]);
+
+		std::fprintf(out, "],\n");
+
+		std::fprintf(
+			out, "\t\t\t\"cycle_models_ns_per_instruction\": { \"exact\": %.4f, \"approximate\": %.4f, \"none\": %.4f },\n",
+			r.best * 1e9 / f64(r.instructions), r.approximate * 1e9 / f64(r.instructions), r.none * 1e9 / f64(r.instructions)
+		);
+
+		if (r.host && r.hostCycles)
+			std::fprintf(
+				out, "\t\t\t\"host_ipc\": %.3f,\n\t\t\t\"host_instructions_per_instruction\": %.2f\n\t\t}",
+				f64(r.hostInstructions) / f64(r.hostCycles), f64(r.hostInstructions) / f64(r.instructions)
+			);
+		else
+			std::fprintf(out, "\t\t\t\"host_ipc\": null,\n\t\t\t\"host_instructions_per_instruction\": null\n\t\t}");
+
+		first = false;
+	}
+
+	std::fprintf(out, "\n\t]\n}\n");
+
+	if (output)
+		std::fclose(out);
+
+	return ok ? 0 : 2;
+}
\ No newline at end of file
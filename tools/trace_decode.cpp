@@ -0,0 +1,89 @@
+#include "arm/armulator_source.hpp"
+#include "arm/trace.hpp"
+#include "arm/thumb/debug.hpp"
+#include <fstream>
+#include <iterator>
+
+//Decodes a binary trace (see arm/trace.hpp) into the disassembly text of PRINT_INSTRUCTION
+//Usage: trace_decode <trace file> [4 or 5; architecture version, default 5]
+
+using namespace arm;
+
+template<Armulator::Version v>
+static void decode(const u8 *ptr, const u8 *end) {
+
+	TraceCodec codec;
+	TraceEvent e;
+	Registers r;
+
+	while (codec.decode(ptr, end, e))
+		switch (e.kind) {
+
+			case TraceEvent::INSTRUCTION:
+
+				printf("%08X: ", e.address);
+
+				if (e.arg) {
+					r.ir = e.value & 0xFFFF;
+					r.nir = e.value >> 16;
+					thumb::printThumb<v>(r);
+				}
+
+				else printf("ARM %08X\n", e.value);
+
+				break;
+
+			case TraceEvent::READ:
+				printf("\tread%u [%08X] = %08X\n", e.arg * 8, e.address, e.value);
+				break;
+
+			case TraceEvent::WRITE:
+				printf("\twrite%u [%08X] = %08X\n", e.arg * 8, e.address, e.value);
+				break;
+
+			case TraceEvent::REGISTER:
+
+				if (e.arg == TraceCodec::cpsr) {
+					printf("\tcpsr = ");
+					Armulator::printPSR(PSR{ e.value });
+				}
+
+				else printf("\tr%u = %08X\n", e.arg, e.value);
+
+				break;
+		}
+
+	if (ptr != end)
+		printf("Trace is truncated or corrupt\n");
+}
+
+int main(int argc, const char **argv) {
+
+	if (argc < 2) {
+		printf("Usage: trace_decode <trace file> [4 or 5]\n");
+		return 1;
+	}
+
+	std::ifstream in(argv[1], std::ios::binary);
+
+	if (!in) {
+		printf("Couldn't open %s\n", argv[1]);
+		return 1;
+	}
+
+	const List<u8> data{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+
+	if (!TraceCodec::validHeader(data.data(), data.size())) {
+		printf("%s isn't a trace\n", argv[1]);
+		return 1;
+	}
+
+	const u8 *begin = data.data() + TraceCodec::headerSize, *end = data.data() + data.size();
+
+	if (argc > 2 && argv[2][0] == '4')
+		decode<Armulator::ARM7TDMI>(begin, end);
+	else
+		decode<Armulator::ARM9TDMI>(begin, end);
+
+	return 0;
+}
\ No newline at end of file